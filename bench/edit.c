@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * edit benchmark
+ * Edits a generated source buffer one form at a time & compares reading it
+ * again in full with `reader_read` against reading only what changed with
+ * `reader_doc_edit`, then checks both read the same lvals.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o edit-bench bench/edit.c lvals.c builtins.c \
+ *       context.c reader.c future.c utils.c bignum.c pool.c mpc/mpc.c \
+ *       -lm -lpthread
+ *   ./edit-bench [megabytes] [edits]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "context.h"
+#include "reader.h"
+
+char* atoms[] = { "+", "-", "max", "head", "list", "len", "==", "12", "-7", "4096", "123456789012345678901234567890" };
+
+/**
+ * generate
+ * Appends a random expression of given depth to the buffer.
+ */
+void generate(char** p, int depth) {
+  if (depth == 0) {
+    *p += sprintf(*p, "%s", atoms[rand() % (sizeof(atoms) / sizeof(char*))]);
+    return;
+  }
+  int n = 1 + rand() % 4;
+  *(*p)++ = rand() % 3 ? '(' : '{';
+  char close = (*p)[-1] == '(' ? ')' : '}';
+  for (int i = 0; i < n; i++) {
+    if (i) { *(*p)++ = ' '; }
+    generate(p, rand() % depth);
+  }
+  *(*p)++ = close;
+}
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+
+  size_t size = (argc > 1 ? atof(argv[1]) : 1) * 1024 * 1024;
+  int edits = argc > 2 ? atoi(argv[2]) : 1000;
+  char* src = malloc(size + 4096);
+  char* p = src;
+  srand(1);
+  while ((size_t)(p - src) < size) {
+    generate(&p, 6);
+    *p++ = '\n';
+  }
+  size_t len = p - src;
+
+  lispy_ctx* ctx = lispy_ctx_new();
+  char* err;
+  double start = now();
+  reader_doc* d = reader_doc_new(ctx, "<bench>", src, len, &err);
+  double full = now() - start;
+  if (err) {
+    fputs(err, stdout);
+    return 1;
+  }
+
+  // Each edit replaces the first atom of some form with another
+  long read = 0;
+  start = now();
+  for (int i = 0; i < edits; i++) {
+    reader_form* f = &d->forms[rand() % d->count];
+    size_t at = f->start;
+    while (d->src[at] == '(' || d->src[at] == '{') { at++; }
+    size_t n = 0;
+    while (d->src[at + n] != ' ' && d->src[at + n] != ')' && d->src[at + n] != '}' && d->src[at + n] != '\n') { n++; }
+    const char* text = atoms[rand() % (sizeof(atoms) / sizeof(char*))];
+    reader_doc_edit(d, at, n, text, strlen(text), &err);
+    if (err) {
+      fputs(err, stdout);
+      return 1;
+    }
+    read += d->read;
+  }
+  double incremental = (now() - start) / edits;
+
+  lval* x = reader_read(ctx, "<bench>", d->src, d->len, &err);
+  lval* y = reader_doc_code(d);
+
+  printf("%.2f MB, %d forms\n", len / 1048576.0, d->count);
+  printf("full        %10.3f ms per read\n", full * 1000);
+  printf("incremental %10.3f ms per edit, %.1f forms read\n", incremental * 1000, (double)read / edits);
+  printf("speedup %.0fx, results %s\n", full / incremental, lval_eq(x, y) ? "equal" : "DIFFER");
+
+  lval_del(x);
+  lval_del(y);
+  reader_doc_del(d);
+  lispy_ctx_del(ctx);
+  free(src);
+  return 0;
+}
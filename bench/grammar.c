@@ -0,0 +1,60 @@
+/*******************************************************************************
+ * grammar profile
+ * Parses source files with the Lispy grammar under the mpc profiler & prints
+ * where the time goes, parser by parser.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o grammar-profile bench/grammar.c lvals.c \
+ *       builtins.c context.c reader.c future.c utils.c bignum.c pool.c \
+ *       mpc/mpc.c -lm -lpthread
+ *   ./grammar-profile [-o out.folded] file...
+ *
+ * The folded stacks written with `-o` can be drawn with flamegraph.pl. Times
+ * come from `clock`, so profile a few megabytes of source for steady numbers.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "context.h"
+
+int main(int argc, char** argv) {
+
+  lispy_ctx* ctx = lispy_ctx_new();
+  mpc_profile_t* prof = mpc_profile_new();
+  char* folded = NULL;
+  int failed = 0;
+
+  for (int i = 1; i < argc; i++) {
+
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      folded = argv[++i];
+      continue;
+    }
+
+    mpc_result_t r;
+    if (mpc_parse_contents_profile(argv[i], ctx->Lispy, prof, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      failed = 1;
+    }
+  }
+
+  mpc_profile_print(prof, stdout);
+
+  if (folded) {
+    FILE* f = fopen(folded, "w");
+    if (f) {
+      mpc_profile_folded(prof, f);
+      fclose(f);
+    } else {
+      perror(folded);
+      failed = 1;
+    }
+  }
+
+  mpc_profile_delete(prof);
+  lispy_ctx_del(ctx);
+  return failed;
+}
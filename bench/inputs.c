@@ -0,0 +1,143 @@
+/*******************************************************************************
+ * input comparison
+ * Parses random inputs from a string, a file, a pipe & a mapped file, under
+ * each grammar flag, & checks all four give the same trees & errors.
+ *
+ * Regexes compiled to DFAs, tokens & tries scan input held in memory in place
+ * but read files & pipes a character at a time, so this catches the two ways
+ * drifting apart - in particular without backtracking, where whatever a failed
+ * attempt consumed stays consumed.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o inputs-check bench/inputs.c mpc/mpc.c -lm
+ *   ./inputs-check [inputs per flag]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mpc/mpc.h"
+
+const char* grammar =
+  " number : /-?[0-9]+(\\.[0-9]+)?/ ;                                   \n"
+  " symbol : '+' | '-' | '*' | /m((in)|(ax))/ | \"head\" | \"list\" | \">=\" | '>' ; \n"
+  " expr   : <number> | <symbol> | <sexpr> | <qexpr> ;                  \n"
+  " sexpr  : '(' <expr>* ')' ;                                          \n"
+  " qexpr  : '{' <expr>* '}' ;                                          \n"
+  " lispy  : /^/ <expr>* /$/ ;                                          \n";
+
+const char* alphabet = "(){}+-*>= \n0123456789.maxinheadlist";
+
+int flags[] = {
+  MPCA_LANG_DEFAULT,
+  MPCA_LANG_PREDICTIVE,
+  MPCA_LANG_PREDICTIVE | MPCA_LANG_PACKRAT,
+  MPCA_LANG_PREDICTIVE | MPCA_LANG_TOKENIZE,
+  MPCA_LANG_TOKENIZE
+};
+
+const char* kinds[] = { "string", "file", "pipe", "mapped file" };
+
+/**
+ * parse
+ * Parses the input at `path`, also held in `src`, in one of four ways.
+ */
+int parse(int kind, const char* path, const char* src, mpc_parser_t* p, mpc_result_t* r) {
+  FILE* f;
+  int ok;
+  switch (kind) {
+    case 0:
+      return mpc_parse(path, src, p, r);
+    case 1:
+    case 2:
+      f = fopen(path, "rb");
+      ok = kind == 1 ? mpc_parse_file(path, f, p, r) : mpc_parse_pipe(path, f, p, r);
+      fclose(f);
+      return ok;
+    default:
+      return mpc_parse_contents(path, p, r);
+  }
+}
+
+/**
+ * same
+ * Compares a result with the one parsed from the string.
+ */
+int same(int ok, mpc_result_t* r, int ok0, mpc_result_t* r0) {
+  if (ok != ok0) { return 0; }
+  if (ok) { return mpc_ast_eq(r->output, r0->output); }
+  char* a = mpc_err_string(r->error);
+  char* b = mpc_err_string(r0->error);
+  int eq = strcmp(a, b) == 0;
+  free(a);
+  free(b);
+  return eq;
+}
+
+void result_del(int ok, mpc_result_t* r) {
+  if (ok) {
+    mpc_ast_delete(r->output);
+  } else {
+    mpc_err_delete(r->error);
+  }
+}
+
+int main(int argc, char** argv) {
+
+  int n = argc > 1 ? atoi(argv[1]) : 2000;
+  char path[] = "/tmp/mpc-inputs-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  int differ = 0;
+  srand(1);
+
+  for (size_t k = 0; k < sizeof(flags) / sizeof(int); k++) {
+
+    mpc_parser_t* number = mpc_new("number");
+    mpc_parser_t* symbol = mpc_new("symbol");
+    mpc_parser_t* expr = mpc_new("expr");
+    mpc_parser_t* sexpr = mpc_new("sexpr");
+    mpc_parser_t* qexpr = mpc_new("qexpr");
+    mpc_parser_t* lispy = mpc_new("lispy");
+    mpca_lang(flags[k], grammar, number, symbol, expr, sexpr, qexpr, lispy, NULL);
+
+    for (int i = 0; i < n; i++) {
+
+      char src[32];
+      int len = rand() % 24;
+      for (int j = 0; j < len; j++) { src[j] = alphabet[rand() % strlen(alphabet)]; }
+      src[len] = '\0';
+
+      FILE* f = fopen(path, "wb");
+      fputs(src, f);
+      fclose(f);
+
+      mpc_result_t r0;
+      int ok0 = parse(0, path, src, lispy, &r0);
+
+      for (int kind = 1; kind < 4; kind++) {
+        mpc_result_t r;
+        int ok = parse(kind, path, src, lispy, &r);
+        if (!same(ok, &r, ok0, &r0)) {
+          printf("flags %d: %s & string differ on \"%s\"\n", flags[k], kinds[kind], src);
+          differ++;
+        }
+        result_del(ok, &r);
+      }
+
+      result_del(ok0, &r0);
+    }
+
+    mpc_cleanup(6, number, symbol, expr, sexpr, qexpr, lispy);
+  }
+
+  remove(path);
+  printf("%d inputs under %d flags, %d differences\n", n, (int)(sizeof(flags) / sizeof(int)), differ);
+  return differ != 0;
+}
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ * packrat benchmark
+ * Compares backtracking & packrat parsing on a grammar with heavy alternation.
+ *
+ * Every alternative of `expr` & `term` starts the same way, so each failed
+ * alternative throws away a whole nested expression & parses it again. With
+ * plain backtracking the work grows nine-fold per level of parentheses; with
+ * `MPCA_LANG_PACKRAT` each rule runs once per position.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o packrat-bench bench/packrat.c mpc/mpc.c -lm
+ *   ./packrat-bench [max depth]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mpc/mpc.h"
+
+const char* grammar =
+  "expr   : <term> '+' <expr> | <term> '-' <expr> | <term> ;      \n"
+  "term   : <factor> '*' <term> | <factor> '/' <term> | <factor> ; \n"
+  "factor : '(' <expr> ')' | /[0-9]+/ ;                           \n"
+  "total  : /^/ <expr> /$/ ;                                      \n";
+
+typedef struct {
+  mpc_parser_t* expr;
+  mpc_parser_t* term;
+  mpc_parser_t* factor;
+  mpc_parser_t* total;
+} language;
+
+language language_new(int flags) {
+  language l;
+  l.expr = mpc_new("expr");
+  l.term = mpc_new("term");
+  l.factor = mpc_new("factor");
+  l.total = mpc_new("total");
+  mpca_lang(flags, grammar, l.expr, l.term, l.factor, l.total, NULL);
+  return l;
+}
+
+void language_del(language l) {
+  mpc_cleanup(4, l.expr, l.term, l.factor, l.total);
+}
+
+/**
+ * generate
+ * Builds `(((...(1+2)...)))` nested `depth` levels deep.
+ */
+char* generate(int depth) {
+  char* s = malloc(2 * depth + 4);
+  char* p = s;
+  for (int i = 0; i < depth; i++) { *p++ = '('; }
+  p += sprintf(p, "1+2");
+  for (int i = 0; i < depth; i++) { *p++ = ')'; }
+  *p = '\0';
+  return s;
+}
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * run
+ * Parses `src` & returns the time taken, storing the tree in `out`.
+ */
+double run(language l, const char* src, mpc_ast_t** out) {
+  mpc_result_t r;
+  double start = now();
+  if (!mpc_parse("<bench>", src, l.total, &r)) {
+    mpc_err_print(r.error);
+    exit(1);
+  }
+  *out = r.output;
+  return now() - start;
+}
+
+int main(int argc, char** argv) {
+
+  int max_depth = argc > 1 ? atoi(argv[1]) : 5;
+
+  language plain = language_new(MPCA_LANG_DEFAULT);
+  language packrat = language_new(MPCA_LANG_PACKRAT);
+
+  printf("%6s %12s %12s %10s %10s\n", "depth", "backtrack", "packrat", "memo hits", "misses");
+
+  unsigned long hits = 0, misses = 0;
+
+  for (int depth = 1; depth <= max_depth; depth++) {
+
+    char* src = generate(depth);
+    mpc_ast_t *a, *b;
+
+    double slow = run(plain, src, &a);
+
+    unsigned long h0, m0;
+    mpc_memo_stats(&h0, &m0);
+    double fast = run(packrat, src, &b);
+    mpc_memo_stats(&hits, &misses);
+
+    if (!mpc_ast_eq(a, b)) {
+      printf("depth %d: packrat tree differs\n", depth);
+      return 1;
+    }
+
+    printf("%6d %12.6f %12.6f %10lu %10lu\n", depth, slow, fast, hits - h0, misses - m0);
+
+    mpc_ast_delete(a);
+    mpc_ast_delete(b);
+    free(src);
+  }
+
+  /* Deep inputs are only practical with memoisation */
+  char* src = generate(2000);
+  mpc_ast_t* deep;
+  printf("depth 2000 with packrat: %.3fs\n", run(packrat, src, &deep));
+  mpc_ast_delete(deep);
+  free(src);
+
+  language_del(plain);
+  language_del(packrat);
+
+  return 0;
+}
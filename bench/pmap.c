@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * pmap benchmark
+ * Reports how `pmap` & `preduce` scale with thread count & chunk size.
+ *
+ * Each element of a Q-Expression of 1 .. N is raised to a large power, so the
+ * work is dominated by bignum multiplication, then the results are summed.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o pmap-bench bench/pmap.c lvals.c builtins.c \
+ *       context.c reader.c future.c utils.c bignum.c pool.c mpc/mpc.c \
+ *       -lm -lpthread
+ *   ./pmap-bench [elements] [max threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "context.h"
+
+lval* num(long n) {
+  value v;
+  v.num = n;
+  return make_lval(LVAL_NUM, v);
+}
+
+lval* sym(char* s) {
+  value v;
+  v.sym = s;
+  return make_lval(LVAL_SYM, v);
+}
+
+lval* expr(int type) {
+  value _;
+  _.num = 0;
+  return make_lval(type, _);
+}
+
+/**
+ * workload
+ * Builds `(preduce {+} (pmap {^ 3} {500 .. 500 + n}))`.
+ */
+lval* workload(int n) {
+
+  lval* xs = expr(LVAL_QEXPR);
+  for (int i = 0; i < n; i++) { xs = lval_add(xs, num(500 + i)); }
+
+  lval* pow3 = lval_add(lval_add(expr(LVAL_QEXPR), sym("^")), num(3));
+  lval* map = lval_add(lval_add(lval_add(expr(LVAL_SEXPR), sym("pmap")), pow3), xs);
+
+  lval* plus = lval_add(expr(LVAL_QEXPR), sym("+"));
+  return lval_add(lval_add(lval_add(expr(LVAL_SEXPR), sym("preduce")), plus), map);
+}
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+
+  int n = argc > 1 ? atoi(argv[1]) : 4000;
+  int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+  int chunks[] = { 1, 16, 64, 256 };
+
+  printf("%8s %8s %10s %8s\n", "threads", "chunk", "seconds", "speedup");
+
+  for (int c = 0; c < 4; c++) {
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+
+      lispy_ctx* ctx = lispy_ctx_new();
+      lispy_ctx_parallel(ctx, threads, LVAL_SPLIT_COST);
+      lispy_ctx_map_chunk(ctx, chunks[c]);
+
+      lval* w = workload(n);
+      double start = now();
+      lval* r = lval_eval(ctx, w);
+      double elapsed = now() - start;
+
+      if (r->type == LVAL_ERR) {
+        lval_println(r);
+        return 1;
+      }
+      lval_del(r);
+
+      if (threads == 1) { base = elapsed; }
+      printf("%8d %8d %10.3f %8.2f\n", threads, chunks[c], elapsed, base / elapsed);
+
+      lispy_ctx_del(ctx);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * reader benchmark
+ * Compares the mpc grammar with the single-pass reader on a generated input
+ * of nested expressions, & checks both read the same lvals. Both are then run
+ * on short random, mostly malformed, inputs to check they report errors at the
+ * same position.
+ *
+ * Build & run from the repository root:
+ *
+ *   gcc -O2 -std=gnu99 -I. -o reader-bench bench/reader.c lvals.c builtins.c \
+ *       context.c reader.c future.c utils.c bignum.c pool.c mpc/mpc.c \
+ *       -lm -lpthread
+ *   ./reader-bench [megabytes]
+ *
+ * mpc reads well under a megabyte per second, so the default input is kept to
+ * a quarter of a megabyte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "context.h"
+
+char* atoms[] = { "+", "-", "max", "head", "list", "len", "==", "12", "-7", "4096", "123456789012345678901234567890" };
+
+/**
+ * generate
+ * Appends a random expression of given depth to the buffer.
+ */
+void generate(char** p, int depth) {
+  if (depth == 0) {
+    *p += sprintf(*p, "%s", atoms[rand() % (sizeof(atoms) / sizeof(char*))]);
+    return;
+  }
+  int n = 1 + rand() % 4;
+  *(*p)++ = rand() % 3 ? '(' : '{';
+  char close = (*p)[-1] == '(' ? ')' : '}';
+  for (int i = 0; i < n; i++) {
+    if (i) { *(*p)++ = ' '; }
+    generate(p, rand() % depth);
+  }
+  *(*p)++ = close;
+}
+
+/**
+ * error_pos
+ * Length of the `file:row:col` prefix of an error, or of the whole string.
+ */
+size_t error_pos(const char* err) {
+  const char* end = strstr(err, ": error:");
+  return end ? (size_t)(end - err) : strlen(err);
+}
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+
+  size_t size = (argc > 1 ? atof(argv[1]) : 0.25) * 1024 * 1024;
+  char* src = malloc(size + 4096);
+  char* p = src;
+  srand(1);
+  while ((size_t)(p - src) < size) {
+    generate(&p, 6);
+    *p++ = '\n';
+  }
+  *p = '\0';
+
+  lispy_ctx* ctx = lispy_ctx_new();
+  lval* x[2];
+  double elapsed[2];
+  char* err;
+
+  for (int i = 0; i < 2; i++) {
+    ctx->hand_reader = i;
+    double start = now();
+    x[i] = lispy_read(ctx, "<bench>", src, &err);
+    elapsed[i] = now() - start;
+    if (!x[i]) {
+      fputs(err, stdout);
+      return 1;
+    }
+  }
+
+  printf("%.2f MB\n", (p - src) / 1048576.0);
+  printf("mpc    %8.3f s %8.1f MB/s\n", elapsed[0], (p - src) / 1048576.0 / elapsed[0]);
+  printf("reader %8.3f s %8.1f MB/s\n", elapsed[1], (p - src) / 1048576.0 / elapsed[1]);
+  printf("speedup %.1fx, results %s\n", elapsed[0] / elapsed[1], lval_eq(x[0], x[1]) ? "equal" : "DIFFER");
+
+  // Random characters from the grammar's alphabet are seldom a valid program
+  const char* alphabet = "(){}+-*/%^<>=! .\n0123456789maxinheadtaillistlenif";
+  int samples = 100000;
+  int errors = 0;
+  int differ = 0;
+  for (int n = 0; n < samples; n++) {
+    char input[32];
+    int len = rand() % (sizeof(input) - 1);
+    for (int k = 0; k < len; k++) { input[k] = alphabet[rand() % strlen(alphabet)]; }
+    input[len] = '\0';
+
+    char* e[2];
+    for (int i = 0; i < 2; i++) {
+      ctx->hand_reader = i;
+      e[i] = NULL;
+      lval* y = lispy_read(ctx, "<bench>", input, &e[i]);
+      if (y) { lval_del(y); }
+    }
+    if (e[0] || e[1]) { errors++; }
+    if ((e[0] == NULL) != (e[1] == NULL)
+      || (e[0] && (error_pos(e[0]) != error_pos(e[1]) || strncmp(e[0], e[1], error_pos(e[0])) != 0))) {
+      differ++;
+    }
+    free(e[0]);
+    free(e[1]);
+  }
+  printf("%d malformed of %d inputs, error positions %s", errors, samples, differ ? "DIFFER" : "equal");
+  if (differ) { printf(" in %d", differ); }
+  printf("\n");
+
+  unsigned long hits, fallbacks;
+  mpc_mem_stats(&hits, &fallbacks);
+  printf("mpc pool %lu hits, %lu fallbacks to malloc\n", hits, fallbacks);
+
+  lval_del(x[0]);
+  lval_del(x[1]);
+  lispy_ctx_del(ctx);
+  free(src);
+  return 0;
+}
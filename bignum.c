@@ -0,0 +1,580 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include "bignum.h"
+
+/*
+ * Magnitudes are handled as (limbs, length) pairs so that Karatsuba can work
+ * on slices of its operands without copying them.
+ */
+
+#define BIGNUM_CHUNK 1000000000u
+#define BIGNUM_CHUNK_DIGITS 9
+
+/*******************************************************************************
+ * big_alloc
+ * Allocates a zeroed bignum with room for `size` limbs.
+ */
+static bignum* big_alloc(int size) {
+  bignum* a = malloc(sizeof(bignum));
+  a->neg = 0;
+  a->size = size;
+  a->limbs = calloc(size > 0 ? size : 1, sizeof(uint32_t));
+  return a;
+}
+
+
+
+/*******************************************************************************
+ * big_trim
+ * Drops leading zero limbs so that `size` is exact & zero is never negative.
+ */
+static bignum* big_trim(bignum* a) {
+  while (a->size > 0 && a->limbs[a->size - 1] == 0) { a->size--; }
+  if (a->size == 0) { a->neg = 0; }
+  return a;
+}
+
+
+
+static int mag_cmp(const uint32_t* a, int an, const uint32_t* b, int bn) {
+  if (an != bn) { return an < bn ? -1 : 1; }
+  for (int i = an - 1; i >= 0; i--) {
+    if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+// out[0..max(an, bn)] = a + b
+static void mag_add(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+  if (an < bn) {
+    const uint32_t* t = a; a = b; b = t;
+    int tn = an; an = bn; bn = tn;
+  }
+  uint64_t carry = 0;
+  for (int i = 0; i < an; i++) {
+    carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+    out[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  out[an] = (uint32_t)carry;
+}
+
+// out[0..an) = a - b, requires a >= b. `out` may alias `a`.
+static void mag_sub(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+  int64_t borrow = 0;
+  for (int i = 0; i < an; i++) {
+    int64_t d = (int64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+    borrow = d < 0;
+    out[i] = (uint32_t)d;
+  }
+}
+
+// out += x, the sum must fit in `outn` limbs
+static void mag_add_into(uint32_t* out, int outn, const uint32_t* x, int xn) {
+  uint64_t carry = 0;
+  int i = 0;
+  for (; i < xn; i++) {
+    carry += (uint64_t)out[i] + x[i];
+    out[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; carry && i < outn; i++) {
+    carry += out[i];
+    out[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+// out -= x, requires out >= x
+static void mag_sub_into(uint32_t* out, int outn, const uint32_t* x, int xn) {
+  int64_t borrow = 0;
+  int i = 0;
+  for (; i < xn; i++) {
+    int64_t d = (int64_t)out[i] - x[i] - borrow;
+    borrow = d < 0;
+    out[i] = (uint32_t)d;
+  }
+  for (; borrow && i < outn; i++) {
+    int64_t d = (int64_t)out[i] - borrow;
+    borrow = d < 0;
+    out[i] = (uint32_t)d;
+  }
+}
+
+static void mag_mul_school(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+  memset(out, 0, sizeof(uint32_t) * (an + bn));
+  for (int i = 0; i < an; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < bn; j++) {
+      carry += (uint64_t)a[i] * b[j] + out[i + j];
+      out[i + j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    out[i + bn] = (uint32_t)carry;
+  }
+}
+
+
+
+/*******************************************************************************
+ * mag_mul
+ * Multiplies two magnitudes into `out`, which must hold `an + bn` limbs.
+ *
+ * @desc Karatsuba: splitting both operands at `m` limbs gives
+ * a*b = z2*B^2m + ((a0+a1)(b0+b1) - z0 - z2)*B^m + z0 with three half-size
+ * products instead of four. Small operands use schoolbook multiplication and
+ * very unbalanced operands are multiplied slice by slice.
+ */
+static void mag_mul(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+
+  if (an < bn) {
+    const uint32_t* t = a; a = b; b = t;
+    int tn = an; an = bn; bn = tn;
+  }
+
+  if (bn < BIGNUM_KARATSUBA_THRESHOLD) {
+    mag_mul_school(a, an, b, bn, out);
+    return;
+  }
+
+  // Unbalanced - multiply `b` by bn-sized slices of `a`
+  if (2 * bn <= an) {
+    uint32_t* t = malloc(sizeof(uint32_t) * 2 * bn);
+    memset(out, 0, sizeof(uint32_t) * (an + bn));
+    for (int off = 0; off < an; off += bn) {
+      int len = (an - off < bn) ? an - off : bn;
+      mag_mul(a + off, len, b, bn, t);
+      mag_add_into(out + off, an + bn - off, t, len + bn);
+    }
+    free(t);
+    return;
+  }
+
+  int m = an / 2;
+  int a1n = an - m;
+  int b1n = bn - m;
+
+  // z0 = a0*b0 in the low half of `out`, z2 = a1*b1 in the high half
+  mag_mul(a, m, b, m, out);
+  mag_mul(a + m, a1n, b + m, b1n, out + 2 * m);
+
+  // z1 = (a0+a1)(b0+b1) - z0 - z2
+  int san = a1n + 1;
+  int sbn = (m > b1n ? m : b1n) + 1;
+  uint32_t* sa = malloc(sizeof(uint32_t) * san);
+  uint32_t* sb = malloc(sizeof(uint32_t) * sbn);
+  uint32_t* z1 = malloc(sizeof(uint32_t) * (san + sbn));
+  mag_add(a, m, a + m, a1n, sa);
+  mag_add(b, m, b + m, b1n, sb);
+  mag_mul(sa, san, sb, sbn, z1);
+  mag_sub_into(z1, san + sbn, out, 2 * m);
+  mag_sub_into(z1, san + sbn, out + 2 * m, a1n + b1n);
+
+  int z1n = san + sbn;
+  while (z1n > 0 && z1[z1n - 1] == 0) { z1n--; }
+  mag_add_into(out + m, an + bn - m, z1, z1n);
+
+  free(sa);
+  free(sb);
+  free(z1);
+}
+
+
+
+/*******************************************************************************
+ * mag_divmod
+ * Long division of `u` (m limbs) by `v` (n limbs, n >= 2, m >= n).
+ *
+ * @desc Knuth's Algorithm D. `q` receives m - n + 1 limbs and `r` n limbs.
+ */
+static void mag_divmod(const uint32_t* u, int m, const uint32_t* v, int n, uint32_t* q, uint32_t* r) {
+
+  const uint64_t b = (uint64_t)1 << 32;
+  uint32_t* vn = malloc(sizeof(uint32_t) * n);
+  uint32_t* un = malloc(sizeof(uint32_t) * (m + 1));
+
+  // Normalise so the top limb of the divisor has its high bit set
+  int s = 0;
+  while (!(v[n - 1] & (0x80000000u >> s))) { s++; }
+
+  for (int i = n - 1; i > 0; i--) {
+    vn[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+  }
+  vn[0] = v[0] << s;
+
+  un[m] = s ? u[m - 1] >> (32 - s) : 0;
+  for (int i = m - 1; i > 0; i--) {
+    un[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+  }
+  un[0] = u[0] << s;
+
+  for (int j = m - n; j >= 0; j--) {
+
+    // Estimate quotient limb from the top two limbs
+    uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+    uint64_t qhat = num / vn[n - 1];
+    uint64_t rhat = num % vn[n - 1];
+    while (qhat >= b || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+      qhat--;
+      rhat += vn[n - 1];
+      if (rhat >= b) { break; }
+    }
+
+    // Multiply & subtract
+    int64_t k = 0;
+    int64_t t;
+    for (int i = 0; i < n; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xFFFFFFFFu);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + n] - k;
+    un[j + n] = (uint32_t)t;
+
+    // Estimate was one too large - add back
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      k = 0;
+      for (int i = 0; i < n; i++) {
+        t = (int64_t)un[i + j] + vn[i] + k;
+        un[i + j] = (uint32_t)t;
+        k = t >> 32;
+      }
+      un[j + n] += (uint32_t)k;
+    }
+  }
+
+  // Denormalise remainder
+  for (int i = 0; i < n - 1; i++) {
+    r[i] = (un[i] >> s) | (s ? un[i + 1] << (32 - s) : 0);
+  }
+  r[n - 1] = un[n - 1] >> s;
+
+  free(vn);
+  free(un);
+}
+
+
+
+/*******************************************************************************
+ * big_from_long
+ * Converts a fixnum to a bignum.
+ *
+ * @param x - The number to convert.
+ * @return - Pointer to a newly allocated bignum.
+ */
+bignum* big_from_long(long x) {
+  unsigned long long m = x < 0 ? 0ULL - (unsigned long long)x : (unsigned long long)x;
+  bignum* a = big_alloc(2);
+  a->neg = x < 0;
+  a->limbs[0] = (uint32_t)m;
+  a->limbs[1] = (uint32_t)(m >> 32);
+  return big_trim(a);
+}
+
+
+
+/*******************************************************************************
+ * big_from_str
+ * Parses a decimal integer, with optional leading `-`.
+ *
+ * @desc Like `strtol`, parsing stops at the first non-digit. Digits are
+ * consumed nine at a time with a single multiply-add per limb.
+ *
+ * @param s - Pointer to the digits.
+ * @param len - Number of bytes available at `s`.
+ * @return - Pointer to a newly allocated bignum.
+ */
+bignum* big_from_str(const char* s, size_t len) {
+
+  size_t i = 0;
+  int neg = 0;
+  if (i < len && s[i] == '-') { neg = 1; i++; }
+
+  size_t digits = 0;
+  while (i + digits < len && s[i + digits] >= '0' && s[i + digits] <= '9') { digits++; }
+
+  bignum* a = big_alloc((int)(digits / BIGNUM_CHUNK_DIGITS) + 2);
+  a->size = 0;
+
+  while (digits > 0) {
+
+    // Take the next (up to) nine digits
+    size_t take = digits % BIGNUM_CHUNK_DIGITS ? digits % BIGNUM_CHUNK_DIGITS : BIGNUM_CHUNK_DIGITS;
+    uint32_t chunk = 0;
+    uint32_t scale = 1;
+    for (size_t j = 0; j < take; j++) {
+      chunk = chunk * 10 + (uint32_t)(s[i + j] - '0');
+      scale *= 10;
+    }
+    i += take;
+    digits -= take;
+
+    // a = a * 10^take + chunk
+    uint64_t carry = chunk;
+    for (int j = 0; j < a->size; j++) {
+      carry += (uint64_t)a->limbs[j] * scale;
+      a->limbs[j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    if (carry) { a->limbs[a->size++] = (uint32_t)carry; }
+  }
+
+  a->neg = neg;
+  return big_trim(a);
+}
+
+
+
+/*******************************************************************************
+ * big_to_long
+ * Converts a bignum back to a fixnum if it fits.
+ *
+ * @param a - Pointer to the bignum.
+ * @param out - Set to the value of `a` on success.
+ * @return - 1 if `a` fits in a long, otherwise 0.
+ */
+int big_to_long(const bignum* a, long* out) {
+
+  if (a->size > 2) { return 0; }
+
+  unsigned long long m = 0;
+  for (int i = a->size - 1; i >= 0; i--) {
+    m = (m << 32) | a->limbs[i];
+  }
+
+  if (!a->neg) {
+    if (m > (unsigned long long)LONG_MAX) { return 0; }
+    *out = (long)m;
+  } else {
+    if (m > (unsigned long long)LONG_MAX + 1) { return 0; }
+    *out = (m == (unsigned long long)LONG_MAX + 1) ? LONG_MIN : -(long)m;
+  }
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * big_to_str
+ * Formats a bignum in decimal.
+ *
+ * @desc The magnitude is divided by 10^9 one limb at a time, yielding nine
+ * digits per pass rather than one.
+ *
+ * @param a - Pointer to the bignum.
+ * @return - Pointer to a newly allocated string.
+ */
+char* big_to_str(const bignum* a) {
+
+  if (a->size == 0) {
+    char* z = malloc(2);
+    strcpy(z, "0");
+    return z;
+  }
+
+  int n = a->size;
+  uint32_t* t = malloc(sizeof(uint32_t) * n);
+  memcpy(t, a->limbs, sizeof(uint32_t) * n);
+
+  // Each limb contributes just under 10 digits - so at most 2 chunks
+  uint32_t* chunks = malloc(sizeof(uint32_t) * (2 * n + 1));
+  int count = 0;
+
+  // At least one chunk, as the magnitude is non-zero
+  do {
+    uint64_t rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | t[i];
+      t[i] = (uint32_t)(cur / BIGNUM_CHUNK);
+      rem = cur % BIGNUM_CHUNK;
+    }
+    chunks[count++] = (uint32_t)rem;
+    while (n > 0 && t[n - 1] == 0) { n--; }
+  } while (n > 0);
+
+  char* s = malloc((size_t)count * BIGNUM_CHUNK_DIGITS + 2);
+  char* p = s;
+  if (a->neg) { *p++ = '-'; }
+  p += sprintf(p, "%u", (unsigned)chunks[count - 1]);
+  for (int i = count - 2; i >= 0; i--) {
+    p += sprintf(p, "%09u", (unsigned)chunks[i]);
+  }
+
+  free(t);
+  free(chunks);
+  return s;
+}
+
+
+
+/*******************************************************************************
+ * big_del
+ * Frees a bignum.
+ */
+void big_del(bignum* a) {
+  if (a == NULL) { return; }
+  free(a->limbs);
+  free(a);
+}
+
+
+
+/*******************************************************************************
+ * big_copy
+ * Returns a newly allocated copy of a bignum.
+ */
+bignum* big_copy(const bignum* a) {
+  bignum* c = big_alloc(a->size);
+  c->neg = a->neg;
+  memcpy(c->limbs, a->limbs, sizeof(uint32_t) * a->size);
+  return c;
+}
+
+
+
+/*******************************************************************************
+ * big_cmp
+ * Compares two bignums.
+ *
+ * @return - Negative, zero or positive as `a` is less than, equal to or greater
+ *         than `b`.
+ */
+int big_cmp(const bignum* a, const bignum* b) {
+  if (a->neg != b->neg) { return a->neg ? -1 : 1; }
+  int c = mag_cmp(a->limbs, a->size, b->limbs, b->size);
+  return a->neg ? -c : c;
+}
+
+
+
+/*******************************************************************************
+ * big_addsub
+ * Returns a + b, where `b` is taken to have sign `bneg`.
+ */
+static bignum* big_addsub(const bignum* a, const bignum* b, int bneg) {
+
+  bignum* r;
+
+  // Same sign - add magnitudes
+  if (a->neg == bneg) {
+    r = big_alloc((a->size > b->size ? a->size : b->size) + 1);
+    mag_add(a->limbs, a->size, b->limbs, b->size, r->limbs);
+    r->neg = a->neg;
+    return big_trim(r);
+  }
+
+  // Opposite signs - subtract smaller magnitude from larger
+  int c = mag_cmp(a->limbs, a->size, b->limbs, b->size);
+  if (c == 0) { return big_alloc(0); }
+  if (c > 0) {
+    r = big_alloc(a->size);
+    mag_sub(a->limbs, a->size, b->limbs, b->size, r->limbs);
+    r->neg = a->neg;
+  } else {
+    r = big_alloc(b->size);
+    mag_sub(b->limbs, b->size, a->limbs, a->size, r->limbs);
+    r->neg = bneg;
+  }
+  return big_trim(r);
+}
+
+bignum* big_add(const bignum* a, const bignum* b) { return big_addsub(a, b, b->neg); }
+bignum* big_sub(const bignum* a, const bignum* b) { return big_addsub(a, b, !b->neg); }
+
+
+
+/*******************************************************************************
+ * big_mul
+ * Returns a * b.
+ */
+bignum* big_mul(const bignum* a, const bignum* b) {
+  if (a->size == 0 || b->size == 0) { return big_alloc(0); }
+  bignum* r = big_alloc(a->size + b->size);
+  mag_mul(a->limbs, a->size, b->limbs, b->size, r->limbs);
+  r->neg = a->neg != b->neg;
+  return big_trim(r);
+}
+
+
+
+/*******************************************************************************
+ * big_divmod
+ * Divides a by b, truncating towards zero like C's `/` & `%`.
+ *
+ * @param q - Set to a newly allocated quotient.
+ * @param r - Set to a newly allocated remainder, with the sign of `a`.
+ * @return - 0 if `b` is zero, otherwise 1.
+ */
+int big_divmod(const bignum* a, const bignum* b, bignum** q, bignum** r) {
+
+  if (b->size == 0) { return 0; }
+
+  if (mag_cmp(a->limbs, a->size, b->limbs, b->size) < 0) {
+    *q = big_alloc(0);
+    *r = big_copy(a);
+    return 1;
+  }
+
+  bignum* quo = big_alloc(a->size - b->size + 1);
+  bignum* rem = big_alloc(b->size);
+
+  if (b->size == 1) {
+    // Short division by a single limb
+    uint64_t d = b->limbs[0];
+    uint64_t rr = 0;
+    for (int i = a->size - 1; i >= 0; i--) {
+      uint64_t cur = (rr << 32) | a->limbs[i];
+      quo->limbs[i] = (uint32_t)(cur / d);
+      rr = cur % d;
+    }
+    rem->limbs[0] = (uint32_t)rr;
+  } else {
+    mag_divmod(a->limbs, a->size, b->limbs, b->size, quo->limbs, rem->limbs);
+  }
+
+  quo->neg = a->neg != b->neg;
+  rem->neg = a->neg;
+  *q = big_trim(quo);
+  *r = big_trim(rem);
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * big_pow
+ * Returns a^e by repeated squaring, or NULL if the result would be longer than
+ * `BIGNUM_POW_MAX_LIMBS`.
+ */
+bignum* big_pow(const bignum* a, unsigned long e) {
+
+  // |a|^e takes about e * log2 |a| bits
+  if (a->size > 0) {
+    double bits = (a->size - 1) * 32.0 + log2(a->limbs[a->size - 1]);
+    if (bits * e > BIGNUM_POW_MAX_LIMBS * 32.0) { return NULL; }
+  }
+
+  bignum* r = big_from_long(1);
+  bignum* base = big_copy(a);
+
+  while (e > 0) {
+    if (e & 1) {
+      bignum* t = big_mul(r, base);
+      big_del(r);
+      r = t;
+    }
+    e >>= 1;
+    if (e) {
+      bignum* t = big_mul(base, base);
+      big_del(base);
+      base = t;
+    }
+  }
+
+  big_del(base);
+  return r;
+}
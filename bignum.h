@@ -0,0 +1,49 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Operand size (in limbs) below which multiplication falls back from
+ * Karatsuba to schoolbook.
+ */
+#ifndef BIGNUM_KARATSUBA_THRESHOLD
+#define BIGNUM_KARATSUBA_THRESHOLD 32
+#endif
+
+/**
+ * Largest result (in limbs) `big_pow` computes. Larger powers are reported as
+ * errors rather than exhausting memory.
+ */
+#ifndef BIGNUM_POW_MAX_LIMBS
+#define BIGNUM_POW_MAX_LIMBS (1 << 15)
+#endif
+
+/**
+ * bignum
+ * Arbitrary-precision integer stored as sign & magnitude. The magnitude is a
+ * little-endian array of base 2^32 limbs with no leading zero limbs.
+ */
+typedef struct bignum {
+  int neg;
+  int size;
+  uint32_t* limbs;
+} bignum;
+
+bignum* big_from_long(long x);
+bignum* big_from_str(const char* s, size_t len);
+int big_to_long(const bignum* a, long* out);
+char* big_to_str(const bignum* a);
+void big_del(bignum* a);
+bignum* big_copy(const bignum* a);
+
+int big_cmp(const bignum* a, const bignum* b);
+bignum* big_add(const bignum* a, const bignum* b);
+bignum* big_sub(const bignum* a, const bignum* b);
+bignum* big_mul(const bignum* a, const bignum* b);
+int big_divmod(const bignum* a, const bignum* b, bignum** q, bignum** r);
+bignum* big_pow(const bignum* a, unsigned long e);
+
+#endif
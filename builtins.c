@@ -1,14 +1,157 @@
-#include "builtins.h"
+#include <limits.h>
+#include "context.h"
 
 #define L_ASSERT(arg, condition, error) if (!(condition)) { lval_del(arg); value e; e.err = error; return make_lval(LVAL_ERR, e); }
 
-char *builtin_names[] = { "head", "tail", "list", "eval", "init", "cons", "len", NULL };
-lval* (*builtinFn[])(lval*) = { builtin_head, builtin_tail, builtin_list, builtin_eval, builtin_init, builtin_cons, builtin_len, NULL };
+char *builtin_names[] = { "head", "tail", "list", "eval", "init", "cons", "len", ">", "<", ">=", "<=", "==", "!=", "pmap", "pfilter", "preduce", "future", "touch", "cancel", NULL };
+lbuiltin builtinFn[] = { builtin_head, builtin_tail, builtin_list, builtin_eval, builtin_init, builtin_cons, builtin_len, builtin_gt, builtin_lt, builtin_ge, builtin_le, builtin_eq, builtin_ne, builtin_pmap, builtin_pfilter, builtin_preduce, builtin_future, builtin_touch, builtin_cancel, NULL };
+
+char *operator_names[] = { "+", "-", "*", "/", "%", "^", "min", "max", NULL };
+
+char *special_names[] = { "if", "and", "or", "when", NULL };
+lbuiltin specialFn[] = { builtin_if, builtin_and, builtin_or, builtin_when, NULL };
+
+/**
+ * map_chunk
+ * A slice of a Q-Expression processed by one task.
+ */
+typedef struct {
+  pool_task task;
+  lispy_ctx* ctx;
+  lval* fn;
+  lval** cells;
+  lval** conds;
+  int count;
+  lval* result;
+} map_chunk;
+
+/*******************************************************************************
+ * fix_op
+ * Applies an operator to two fixnums.
+ *
+ * @desc The fast path of `builtin_op`: overflow is detected with the compiler's
+ * checked arithmetic builtins rather than by widening.
+ *
+ * @param op - The operation to perform.
+ * @param x - The left operand.
+ * @param y - The right operand. Non-zero for `/` & `%`, non-negative for `^`.
+ * @param r - Set to the result on success.
+ *
+ * @return - 1 if the result fits in a long, 0 if it overflowed.
+ */
+int fix_op(char* op, long x, long y, long* r) {
+
+  // `r` is only written on success - it may alias `x`
+  long t;
+
+  switch (*op) {
+    case '+':
+      if (__builtin_add_overflow(x, y, &t)) { return 0; }
+      *r = t;
+      return 1;
+    case '-':
+      if (__builtin_sub_overflow(x, y, &t)) { return 0; }
+      *r = t;
+      return 1;
+    case '*':
+      if (__builtin_mul_overflow(x, y, &t)) { return 0; }
+      *r = t;
+      return 1;
+    case '/':
+      if (x == LONG_MIN && y == -1) { return 0; }
+      *r = x / y;
+      return 1;
+    case '%':
+      *r = (y == -1) ? 0 : x % y;
+      return 1;
+    case '^': {
+      long acc = 1;
+      while (y > 0) {
+        if ((y & 1) && __builtin_mul_overflow(acc, x, &acc)) { return 0; }
+        y >>= 1;
+        if (y && __builtin_mul_overflow(x, x, &x)) { return 0; }
+      }
+      *r = acc;
+      return 1;
+    }
+    case 'm':
+      if (*(op + 1) == 'i') {
+        // Operator is "min"
+        *r = (y < x) ? y : x;
+      } else {
+        // Operator is "max"
+        *r = (y > x) ? y : x;
+      }
+      return 1;
+  }
+  return 0;
+}
+
+
+
+/*******************************************************************************
+ * big_op
+ * Applies an operator to two bignums.
+ *
+ * @param op - The operation to perform.
+ * @param x - The left operand.
+ * @param y - The right operand. Non-zero for `/` & `%`, non-negative for `^`.
+ *
+ * @return - Pointer to a newly allocated result, or NULL if the result of `^`
+ *         would be longer than `BIGNUM_POW_MAX_LIMBS`.
+ */
+bignum* big_op(char* op, bignum* x, bignum* y) {
+
+  bignum* q;
+  bignum* r;
+  long e;
+
+  switch (*op) {
+    case '+':
+      return big_add(x, y);
+    case '-':
+      return big_sub(x, y);
+    case '*':
+      return big_mul(x, y);
+    case '/':
+      big_divmod(x, y, &q, &r);
+      big_del(r);
+      return q;
+    case '%':
+      big_divmod(x, y, &q, &r);
+      big_del(q);
+      return r;
+    case '^':
+      // Powers of 0, 1 & -1 are small whatever the exponent
+      if (y->size == 0) { return big_from_long(1); }
+      if (x->size == 0) { return big_from_long(0); }
+      if (x->size == 1 && x->limbs[0] == 1) {
+        return big_from_long(x->neg && (y->limbs[0] & 1) ? -1 : 1);
+      }
+      if (!big_to_long(y, &e)) { return NULL; }
+      return big_pow(x, (unsigned long)e);
+    case 'm':
+      if (*(op + 1) == 'i') {
+        // Operator is "min"
+        return big_copy(big_cmp(y, x) < 0 ? y : x);
+      }
+      // Operator is "max"
+      return big_copy(big_cmp(y, x) > 0 ? y : x);
+  }
+  return NULL;
+}
+
+
 
 /*******************************************************************************
  * builtin_op
  * Evaluates given lval according to given operator.
  *
+ * @desc The result is accumulated as a fixnum for as long as it fits in a long.
+ * Only an overflowing step (or a bignum argument) promotes the accumulator to
+ * a bignum, and it is demoted again as soon as it fits. Small results come
+ * from the immortal integer cache and no argument is modified in place.
+ *
  * @param a - The lval to evaluate.
  * @param op - The operation to perform.
  * @return {loval*} - The resulting expression.
@@ -17,89 +160,70 @@ lval* builtin_op(lval* a, char* op) {
 
   // Ensure all arguments are numbers
   for (int i = 0; i < a->count; i++) {
-    if (a->val.cell[i]->type != LVAL_NUM) {
-      lval_del(a);
-      value v;
-      v.err = L_ERR_BAD_NUM;
-      return make_lval(LVAL_ERR, v);
+    L_ASSERT(a, LVAL_IS_NUM(a->val.cell[i]), L_ERR_BAD_NUM);
+  }
+
+  // Ensure divisors are non-zero & exponents non-negative
+  for (int i = 1; i < a->count; i++) {
+    lval* y = a->val.cell[i];
+    if (*op == '/' || *op == '%') {
+      L_ASSERT(a, !(y->type == LVAL_NUM && y->val.num == 0), L_ERR_DIV_ZERO);
+    }
+    if (*op == '^') {
+      L_ASSERT(a, (y->type == LVAL_NUM) ? y->val.num >= 0 : !y->val.big->neg, L_ERR_BAD_NUM);
     }
   }
 
-  // Pop first element
-  lval* x = lval_pop(a, 0);
-  value result = x->val;
+  // Start from first element - `bx` is non-NULL while the result is a bignum
+  lval* first = a->val.cell[0];
+  long x = 0;
+  bignum* bx = NULL;
+  if (first->type == LVAL_NUM) {
+    x = first->val.num;
+  } else {
+    bx = big_copy(first->val.big);
+  }
 
   // If subtraction operator & no arguments - perform unary negation
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->val.num = -x->val.num;
+  if ((strcmp(op, "-") == 0) && a->count == 1) {
+    if (!bx && x != LONG_MIN) {
+      x = -x;
+    } else {
+      if (!bx) { bx = big_from_long(x); }
+      bx->neg = !bx->neg;
+    }
   }
 
-  /* While there are still elements remaining */
-  while (a->count > 0) {
+  /* For each remaining element */
+  for (int i = 1; i < a->count; i++) {
 
-    /* Pop the next element */
-    lval* y = lval_pop(a, 0);
+    lval* y = a->val.cell[i];
 
-    switch (*op) {
-      case '+':
-        x->val.num += y->val.num;
-      break;
-      case '-':
-        x->val.num -= y->val.num;
-      break;
-      case '*':
-        x->val.num *= y->val.num;
-      break;
-      case '/':
-        if (y->val.num == 0) {
-          lval_del(x);
-          value v;
-          v.err = L_ERR_DIV_ZERO;
-          x = make_lval(LVAL_ERR, v);
-          break;
-        } else {
-          x->val.num /= y->val.num;
-        }
-      break;
-      case '%':
-        x->val.num %= y->val.num;
-      break;
-      case '^':
-        if (y->val.num == 0) {
-          result.num = 1;
-        } else if (y->val.num == 1) {
-          continue;
-        } else {
-          while (y->val.num > 1) {
-            result.num *= x->val.num;
-            y->val.num--;
-          }
-        }
-        x->val.num = result.num;
-      break;
-      case 'm':
-        switch (*(op + 1)) {
-          case 'i':
-            // Operator is "min"
-            result.num = (y->val.num < result.num) ? y->val.num : x->val.num;
-          break;
-          case 'a':
-            // Operator is "max"
-            result.num = (y->val.num > result.num) ? y->val.num : x->val.num;
-          break;
-        }
-        x->val = result;
-      break;
-      case 'h':
-      break;
-      case 't':
-        x->val = y->val;
-      break;
+    // Fast path - fixnum operands & no overflow
+    if (!bx && y->type == LVAL_NUM && fix_op(op, x, y->val.num, &x)) { continue; }
+
+    // Slow path - promote both operands
+    if (!bx) { bx = big_from_long(x); }
+    bignum* by = (y->type == LVAL_BIG) ? y->val.big : big_from_long(y->val.num);
+    bignum* r = big_op(op, bx, by);
+    if (y->type == LVAL_NUM) { big_del(by); }
+    big_del(bx);
+    bx = r;
+
+    L_ASSERT(a, bx != NULL, L_ERR_TOO_LARGE);
+
+    // Demote back to a fixnum once the result fits again
+    if (big_to_long(bx, &x)) {
+      big_del(bx);
+      bx = NULL;
     }
-    lval_del(y);
   }
+
   lval_del(a);
-  return x;
+  if (bx) { return lval_from_big(bx); }
+  value r;
+  r.num = x;
+  return make_lval(LVAL_NUM, r);
 }
 
 
@@ -113,20 +237,22 @@ lval* builtin_op(lval* a, char* op) {
  *
  * @return - Pointer to resulting lval or error lval.
  */
-lval* builtin(lval* a, char* func) {
+lval* builtin(lispy_ctx* ctx, lval* a, char* func) {
 
   // Search builtin command list for the given function
-  for (int i = 0; builtin_names[i] != NULL; i++) {
+  for (int i = 0; ctx->builtin_names[i] != NULL; i++) {
 
     // If found, execute the builtin command
-    if (strcmp(func, builtin_names[i]) == 0) {
-      return builtinFn[i](a);
+    if (strcmp(func, ctx->builtin_names[i]) == 0) {
+      LISPY_STAT(ctx, builtins);
+      return ctx->builtin_fns[i](ctx, a);
     }
 
   }
 
   // If given function matches a builtin operation, perform operation
-  if (strstr("+-/*", func)) {
+  if (strstr("+-/*%^", func) || strcmp(func, "min") == 0 || strcmp(func, "max") == 0) {
+    LISPY_STAT(ctx, builtins);
     return builtin_op(a, func);
   }
 
@@ -147,7 +273,7 @@ lval* builtin(lval* a, char* func) {
  *
  * @return -  Pointer to the first element of Q-Expression.
  */
-lval* builtin_head(lval* args) {
+lval* builtin_head(lispy_ctx* ctx, lval* args) {
 
   // Ensure only one argument passed
   L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
@@ -180,7 +306,7 @@ lval* builtin_head(lval* args) {
  *
  * @return v - Pointer to the list of remaining elements.
  */
-lval* builtin_tail(lval* args) {
+lval* builtin_tail(lispy_ctx* ctx, lval* args) {
 
   // Ensure only one argument passed
   L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
@@ -209,7 +335,7 @@ lval* builtin_tail(lval* args) {
  *
  * @return a - Pointer to the Q-Expression.
  */
-lval* builtin_list(lval* a) {
+lval* builtin_list(lispy_ctx* ctx, lval* a) {
   a->type = LVAL_QEXPR;
   return a;
 }
@@ -228,7 +354,7 @@ lval* builtin_list(lval* a) {
  *
  * @return a - Pointer to the lval resulting from evaluation.
  */
-lval* builtin_eval(lval* args) {
+lval* builtin_eval(lispy_ctx* ctx, lval* args) {
 
   // Ensure only one argument passed
   L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
@@ -237,9 +363,17 @@ lval* builtin_eval(lval* args) {
   L_ASSERT(args, args->val.cell[0]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
 
   lval* x = lval_take(args, 0);
+
+  // {} is the shared empty Q-Expression - evaluate the shared () instead
+  if (lval_is_immortal(x)) {
+    value _;
+    _.num = 0;
+    return make_lval(LVAL_SEXPR, _);
+  }
+
   x->type = LVAL_SEXPR;
 
-  return lval_eval(x);
+  return lval_eval(ctx, x);
 }
 
 
@@ -253,7 +387,7 @@ lval* builtin_eval(lval* args) {
  *
  * @return - Pointer to the list of remaining elements.
  */
-lval* builtin_init(lval* args) {
+lval* builtin_init(lispy_ctx* ctx, lval* args) {
 
   // Ensure only one argument passed
   L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
@@ -285,13 +419,13 @@ lval* builtin_init(lval* args) {
  * cons 1 {2 3 4}
  * // => {1 2 3 4}
  */
-lval* builtin_cons(lval* args) {
+lval* builtin_cons(lispy_ctx* ctx, lval* args) {
 
   // Ensure exactly two arguments passed
   L_ASSERT(args, args->count == 2, L_ERR_ARG_COUNT);
 
   // Ensure arguments are valid types
-  L_ASSERT(args, args->val.cell[0]->type == LVAL_NUM, L_ERR_BAD_TYPE);
+  L_ASSERT(args, LVAL_IS_NUM(args->val.cell[0]), L_ERR_BAD_TYPE);
   L_ASSERT(args, args->val.cell[1]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
 
   // Create new Q-Expression with a dummy value
@@ -303,10 +437,11 @@ lval* builtin_cons(lval* args) {
   new_q = lval_add(new_q, lval_pop(args, 0));
 
   // Append elements in given Q-Expression to new Q-Expression
-  lval* r = lval_eval(lval_take(args, 0));
+  lval* r = lval_eval(ctx, lval_take(args, 0));
   while (r->count) {
     new_q = lval_add(new_q, lval_pop(r, 0));
   }
+  lval_del(r);
 
   return new_q;
 }
@@ -326,7 +461,7 @@ lval* builtin_cons(lval* args) {
  * len {2 4 6 8}
  * // => 4
  */
-lval* builtin_len(lval* args) {
+lval* builtin_len(lispy_ctx* ctx, lval* args) {
 
   // Ensure `len` was passed only one argument
   L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
@@ -340,7 +475,693 @@ lval* builtin_len(lval* args) {
   // Convert # of elements in given Q-Expression to a valid lispy value
   value v;
   v.num = q_expr->count;
+  lval_del(q_expr);
 
   // Return new lval
   return make_lval(LVAL_NUM, v);
 }
+
+
+
+
+/*******************************************************************************
+ * builtin_ord
+ * Compares the order of two numbers according to given operator.
+ *
+ * @param a - Pointer to the two numbers to compare.
+ * @param op - The comparison to perform: `>`, `<`, `>=` or `<=`.
+ *
+ * @return - Pointer to 1 if the comparison holds, otherwise 0.
+ */
+lval* builtin_ord(lval* a, char* op) {
+
+  // Ensure exactly two numbers passed
+  L_ASSERT(a, a->count == 2, L_ERR_ARG_COUNT);
+  L_ASSERT(a, LVAL_IS_NUM(a->val.cell[0]), L_ERR_BAD_NUM);
+  L_ASSERT(a, LVAL_IS_NUM(a->val.cell[1]), L_ERR_BAD_NUM);
+
+  int c = lval_num_cmp(a->val.cell[0], a->val.cell[1]);
+
+  value r;
+  if (strcmp(op, ">") == 0)  { r.num = (c > 0); }
+  if (strcmp(op, "<") == 0)  { r.num = (c < 0); }
+  if (strcmp(op, ">=") == 0) { r.num = (c >= 0); }
+  if (strcmp(op, "<=") == 0) { r.num = (c <= 0); }
+
+  lval_del(a);
+  return make_lval(LVAL_NUM, r);
+}
+
+lval* builtin_gt(lispy_ctx* ctx, lval* a) { return builtin_ord(a, ">"); }
+lval* builtin_lt(lispy_ctx* ctx, lval* a) { return builtin_ord(a, "<"); }
+lval* builtin_ge(lispy_ctx* ctx, lval* a) { return builtin_ord(a, ">="); }
+lval* builtin_le(lispy_ctx* ctx, lval* a) { return builtin_ord(a, "<="); }
+
+
+
+/*******************************************************************************
+ * builtin_cmp
+ * Compares two values of any type for equality.
+ *
+ * @param a - Pointer to the two values to compare.
+ * @param op - The comparison to perform: `==` or `!=`.
+ *
+ * @return - Pointer to 1 if the comparison holds, otherwise 0.
+ *
+ * @example
+ *
+ * == {1 2} {1 2}
+ * // => 1
+ */
+lval* builtin_cmp(lval* a, char* op) {
+
+  // Ensure exactly two arguments passed
+  L_ASSERT(a, a->count == 2, L_ERR_ARG_COUNT);
+
+  value r;
+  r.num = lval_eq(a->val.cell[0], a->val.cell[1]);
+  if (strcmp(op, "!=") == 0) { r.num = !r.num; }
+
+  lval_del(a);
+  return make_lval(LVAL_NUM, r);
+}
+
+lval* builtin_eq(lispy_ctx* ctx, lval* a) { return builtin_cmp(a, "=="); }
+lval* builtin_ne(lispy_ctx* ctx, lval* a) { return builtin_cmp(a, "!="); }
+
+
+
+/*******************************************************************************
+ * is_special
+ * Returns 1 if given symbol names a special form.
+ *
+ * @desc Special forms receive their arguments unevaluated, so `lval_eval_sexpr`
+ * must check for them before it evaluates any children.
+ *
+ * @param func - Pointer to the symbol to check.
+ *
+ * @return 1 if `func` is a special form, otherwise 0.
+ */
+int is_special(lispy_ctx* ctx, char* func) {
+  for (int i = 0; ctx->special_names[i] != NULL; i++) {
+    if (strcmp(func, ctx->special_names[i]) == 0) { return 1; }
+  }
+  return 0;
+}
+
+
+
+/*******************************************************************************
+ * special
+ * Executes the special form with given name.
+ *
+ * @param a - Pointer to the unevaluated arguments of the special form.
+ * @param form - Pointer to the name of the special form.
+ *
+ * @return - Pointer to resulting lval or error lval.
+ */
+lval* special(lispy_ctx* ctx, lval* a, char* form) {
+
+  for (int i = 0; ctx->special_names[i] != NULL; i++) {
+    if (strcmp(form, ctx->special_names[i]) == 0) {
+      return ctx->special_fns[i](ctx, a);
+    }
+  }
+
+  lval_del(a);
+  value e;
+  e.err = L_ERR_BAD_OP;
+  return make_lval(LVAL_ERR, e);
+}
+
+
+
+/*******************************************************************************
+ * eval_cond
+ * Evaluates the first of given arguments as a condition.
+ *
+ * @desc Pops & evaluates the element at index 0. On failure `args` is deleted
+ * and the error is written to `err`.
+ *
+ * @param args - Pointer to the unevaluated arguments of a special form.
+ * @param err - Set to the resulting error lval if the condition is invalid.
+ *
+ * @return - 1 if the condition is a non-zero number, otherwise 0.
+ */
+int eval_cond(lispy_ctx* ctx, lval* args, lval** err) {
+
+  lval* c = lval_eval(ctx, lval_pop(args, 0));
+  *err = NULL;
+
+  // Ensure condition evaluated to a number
+  if (!LVAL_IS_NUM(c)) {
+    lval_del(args);
+    if (c->type == LVAL_ERR) {
+      *err = c;
+    } else {
+      lval_del(c);
+      value e;
+      e.err = L_ERR_BAD_TYPE;
+      *err = make_lval(LVAL_ERR, e);
+    }
+    return 0;
+  }
+
+  // Bignums are never zero
+  int truth = (c->type == LVAL_BIG || c->val.num != 0);
+  lval_del(c);
+  return truth;
+}
+
+
+
+/*******************************************************************************
+ * builtin_if
+ * Evaluates one of two branches depending on a condition.
+ *
+ * @desc Only the condition and the taken branch are evaluated. The untaken
+ * branch is deleted as read.
+ *
+ * @param args - Pointer to the unevaluated condition (index 0), then-branch
+ *        (index 1) and else-branch (index 2).
+ *
+ * @return - Pointer to the result of evaluating the taken branch.
+ *
+ * @example
+ *
+ * if (> 2 1) (+ 1 1) (/ 1 0)
+ * // => 2
+ */
+lval* builtin_if(lispy_ctx* ctx, lval* args) {
+
+  // Ensure exactly three arguments passed
+  L_ASSERT(args, args->count == 3, L_ERR_ARG_COUNT);
+
+  lval* err;
+  int truth = eval_cond(ctx, args, &err);
+  if (err) { return err; }
+
+  // Remaining arguments are the branches - keep the taken one only
+  return lval_eval(ctx, lval_take(args, truth ? 0 : 1));
+}
+
+
+
+/*******************************************************************************
+ * builtin_and
+ * Evaluates arguments in order until one is 0.
+ *
+ * @param args - Pointer to the unevaluated arguments.
+ *
+ * @return - Pointer to the first 0 encountered, or to the last value.
+ *
+ * @example
+ *
+ * and 1 0 (/ 1 0)
+ * // => 0
+ */
+lval* builtin_and(lispy_ctx* ctx, lval* args) {
+
+  // Ensure at least one argument passed
+  L_ASSERT(args, args->count > 0, L_ERR_ARG_COUNT);
+
+  lval* x = NULL;
+  while (args->count > 0) {
+    if (x) { lval_del(x); }
+    x = lval_eval(ctx, lval_pop(args, 0));
+    if (x->type == LVAL_ERR) { break; }
+    if (!LVAL_IS_NUM(x)) {
+      lval_del(x);
+      value e;
+      e.err = L_ERR_BAD_TYPE;
+      x = make_lval(LVAL_ERR, e);
+      break;
+    }
+    if (x->type == LVAL_NUM && x->val.num == 0) { break; }
+  }
+
+  // Remaining arguments are never evaluated
+  lval_del(args);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * builtin_or
+ * Evaluates arguments in order until one is non-zero.
+ *
+ * @param args - Pointer to the unevaluated arguments.
+ *
+ * @return - Pointer to the first non-zero value encountered, or to the last value.
+ *
+ * @example
+ *
+ * or 0 2 (/ 1 0)
+ * // => 2
+ */
+lval* builtin_or(lispy_ctx* ctx, lval* args) {
+
+  // Ensure at least one argument passed
+  L_ASSERT(args, args->count > 0, L_ERR_ARG_COUNT);
+
+  lval* x = NULL;
+  while (args->count > 0) {
+    if (x) { lval_del(x); }
+    x = lval_eval(ctx, lval_pop(args, 0));
+    if (x->type == LVAL_ERR) { break; }
+    if (!LVAL_IS_NUM(x)) {
+      lval_del(x);
+      value e;
+      e.err = L_ERR_BAD_TYPE;
+      x = make_lval(LVAL_ERR, e);
+      break;
+    }
+    if (x->type == LVAL_BIG || x->val.num != 0) { break; }
+  }
+
+  // Remaining arguments are never evaluated
+  lval_del(args);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * builtin_when
+ * Evaluates a body of expressions only if a condition is non-zero.
+ *
+ * @param args - Pointer to the unevaluated condition (index 0) followed by the
+ *        expressions to evaluate in order.
+ *
+ * @return - Pointer to the value of the last expression, or to () if the
+ *         condition is 0.
+ *
+ * @example
+ *
+ * when (== 1 1) (+ 1 2) (* 2 3)
+ * // => 6
+ */
+lval* builtin_when(lispy_ctx* ctx, lval* args) {
+
+  // Ensure a condition and at least one expression passed
+  L_ASSERT(args, args->count > 1, L_ERR_ARG_COUNT);
+
+  lval* err;
+  int truth = eval_cond(ctx, args, &err);
+  if (err) { return err; }
+
+  // Condition is 0 - discard body unevaluated
+  if (!truth) {
+    lval_del(args);
+    value _;
+    _.num = 0;
+    return make_lval(LVAL_SEXPR, _);
+  }
+
+  lval* x = NULL;
+  while (args->count > 0) {
+    if (x) { lval_del(x); }
+    x = lval_eval(ctx, lval_pop(args, 0));
+    if (x->type == LVAL_ERR) { break; }
+  }
+
+  lval_del(args);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * apply_fn
+ * Evaluates a function Q-Expression with one or two extra arguments appended.
+ *
+ * @param fn - Pointer to the function, e.g. `{* 2}`. Left untouched.
+ * @param x - Pointer to the first argument to append. Consumed.
+ * @param y - Pointer to the second argument to append, or NULL. Consumed.
+ *
+ * @return - Pointer to the result of evaluating `(fn... x y)`.
+ */
+lval* apply_fn(lispy_ctx* ctx, lval* fn, lval* x, lval* y) {
+
+  value _;
+  _.num = 0;
+  lval* e = make_lval(LVAL_SEXPR, _);
+
+  for (int i = 0; i < fn->count; i++) {
+    e = lval_add(e, lval_copy(fn->val.cell[i]));
+  }
+  e = lval_add(e, x);
+  if (y) { e = lval_add(e, y); }
+
+  return lval_eval(ctx, e);
+}
+
+
+
+/*******************************************************************************
+ * map_task
+ * Applies a chunk's function to each of its elements. Results replace the
+ * elements, or go to `conds` if set - leaving the elements in place.
+ */
+void map_task(void* arg) {
+  map_chunk* c = arg;
+  for (int i = 0; i < c->count; i++) {
+    if (c->conds) {
+      c->conds[i] = apply_fn(c->ctx, c->fn, lval_copy(c->cells[i]), NULL);
+    } else {
+      c->cells[i] = apply_fn(c->ctx, c->fn, c->cells[i], NULL);
+    }
+  }
+}
+
+
+
+/*******************************************************************************
+ * reduce_task
+ * Folds a chunk's elements from the left into `result`, consuming them.
+ */
+void reduce_task(void* arg) {
+  map_chunk* c = arg;
+  lval* acc = c->cells[0];
+  for (int i = 1; i < c->count; i++) {
+    if (acc->type == LVAL_ERR) {
+      lval_del(c->cells[i]);
+    } else {
+      acc = apply_fn(c->ctx, c->fn, acc, c->cells[i]);
+    }
+  }
+  c->result = acc;
+}
+
+
+
+/*******************************************************************************
+ * run_chunks
+ * Splits a Q-Expression into chunks & runs a task over each of them.
+ *
+ * @desc Chunks go to the evaluation pool, if there is one, except for the last
+ * which the calling thread runs before helping with the rest. Without a pool
+ * every chunk runs in order on the calling thread.
+ *
+ * @param fn - Pointer to the function Q-Expression.
+ * @param q - Pointer to the Q-Expression to split. Must not be empty.
+ * @param conds - Array to pass to `map_task`, or NULL.
+ * @param task - The task to run on each chunk.
+ * @param n - Set to the number of chunks.
+ *
+ * @return - Pointer to the chunks, in order. Must be freed by the caller.
+ */
+map_chunk* run_chunks(lispy_ctx* ctx, lval* fn, lval* q, lval** conds, void (*task)(void*), int* n) {
+
+  pool* p = ctx->pool;
+  int size = ctx->map_chunk;
+  *n = (q->count + size - 1) / size;
+  map_chunk* chunks = malloc(sizeof(map_chunk) * *n);
+
+  for (int i = 0; i < *n; i++) {
+    int start = i * size;
+    chunks[i].task.fn = task;
+    chunks[i].task.arg = &chunks[i];
+    chunks[i].ctx = ctx;
+    chunks[i].fn = fn;
+    chunks[i].cells = &q->val.cell[start];
+    chunks[i].conds = conds ? &conds[start] : NULL;
+    chunks[i].count = (q->count - start < size) ? q->count - start : size;
+    chunks[i].result = NULL;
+    if (p && i < *n - 1) { pool_submit(p, &chunks[i].task); }
+  }
+
+  if (!p) {
+    for (int i = 0; i < *n; i++) { task(&chunks[i]); }
+    return chunks;
+  }
+
+  task(&chunks[*n - 1]);
+  for (int i = 0; i < *n - 1; i++) {
+    pool_wait(p, &chunks[i].task);
+  }
+
+  return chunks;
+}
+
+
+
+/*******************************************************************************
+ * builtin_pmap
+ * Applies a function to every element of a Q-Expression, in parallel.
+ *
+ * @desc Each element is appended to the function as its last argument. The
+ * results keep the order of the elements. If any application fails the error
+ * of the first failing element is returned.
+ *
+ * @param args - The function (at index 0) & the Q-Expression (at index 1).
+ *
+ * @return - Pointer to the Q-Expression of results.
+ *
+ * @example
+ *
+ * pmap {* 2} {1 2 3}
+ * // => {2 4 6}
+ */
+lval* builtin_pmap(lispy_ctx* ctx, lval* args) {
+
+  // Ensure exactly two Q-Expressions passed
+  L_ASSERT(args, args->count == 2, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+  L_ASSERT(args, args->val.cell[1]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+
+  lval* fn = lval_pop(args, 0);
+  lval* q = lval_take(args, 0);
+
+  if (q->count) {
+    int n;
+    free(run_chunks(ctx, fn, q, NULL, map_task, &n));
+  }
+  lval_del(fn);
+
+  // Return the first error, if any
+  for (int i = 0; i < q->count; i++) {
+    if (q->val.cell[i]->type == LVAL_ERR) { return lval_take(q, i); }
+  }
+
+  return q;
+}
+
+
+
+/*******************************************************************************
+ * builtin_pfilter
+ * Keeps the elements of a Q-Expression a predicate holds for, in parallel.
+ *
+ * @desc Each element is appended to the predicate as its last argument and
+ * kept if the result is a non-zero number. If any application fails, or gives
+ * something other than a number, the first such error is returned.
+ *
+ * @param args - The predicate (at index 0) & the Q-Expression (at index 1).
+ *
+ * @return - Pointer to the Q-Expression of kept elements, in order.
+ *
+ * @example
+ *
+ * pfilter {< 2} {1 2 3 4}
+ * // => {3 4}
+ */
+lval* builtin_pfilter(lispy_ctx* ctx, lval* args) {
+
+  // Ensure exactly two Q-Expressions passed
+  L_ASSERT(args, args->count == 2, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+  L_ASSERT(args, args->val.cell[1]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+
+  lval* fn = lval_pop(args, 0);
+  lval* q = lval_take(args, 0);
+
+  if (!q->count) {
+    lval_del(fn);
+    return q;
+  }
+
+  lval** conds = malloc(sizeof(lval*) * q->count);
+  int n;
+  free(run_chunks(ctx, fn, q, conds, map_task, &n));
+  lval_del(fn);
+
+  // Find the first error or non-number result
+  lval* err = NULL;
+  for (int i = 0; i < q->count && !err; i++) {
+    if (conds[i]->type == LVAL_ERR) {
+      err = conds[i];
+      conds[i] = NULL;
+    } else if (!LVAL_IS_NUM(conds[i])) {
+      value e;
+      e.err = L_ERR_BAD_TYPE;
+      err = make_lval(LVAL_ERR, e);
+    }
+  }
+
+  // Move kept elements to a new Q-Expression, delete the rest
+  value _;
+  _.num = 0;
+  lval* kept = make_lval(LVAL_QEXPR, _);
+  for (int i = 0; i < q->count; i++) {
+    // Bignums are never zero
+    int truth = conds[i] && LVAL_IS_NUM(conds[i]) && (conds[i]->type == LVAL_BIG || conds[i]->val.num != 0);
+    if (!err && truth) {
+      kept = lval_add(kept, q->val.cell[i]);
+    } else {
+      lval_del(q->val.cell[i]);
+    }
+    if (conds[i]) { lval_del(conds[i]); }
+  }
+  free(conds);
+  q->count = 0;
+  lval_del(q);
+
+  if (err) {
+    lval_del(kept);
+    return err;
+  }
+  return kept;
+}
+
+
+
+/*******************************************************************************
+ * builtin_preduce
+ * Combines the elements of a Q-Expression with a function, in parallel.
+ *
+ * @desc Each chunk is folded from the left by applying the function to the
+ * running result & the next element; the chunk results are then folded the
+ * same way, in order. The function must therefore be associative for the
+ * result not to depend on the chunk size.
+ *
+ * @param args - The function (at index 0) & the Q-Expression (at index 1).
+ *
+ * @return - Pointer to the combined result.
+ *
+ * @example
+ *
+ * preduce {+} {1 2 3 4}
+ * // => 10
+ */
+lval* builtin_preduce(lispy_ctx* ctx, lval* args) {
+
+  // Ensure exactly two Q-Expressions passed
+  L_ASSERT(args, args->count == 2, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+  L_ASSERT(args, args->val.cell[1]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+
+  // Ensure there is something to reduce
+  L_ASSERT(args, args->val.cell[1]->count != 0, L_ERR_EMPTY_Q);
+
+  lval* fn = lval_pop(args, 0);
+  lval* q = lval_take(args, 0);
+
+  int n;
+  map_chunk* chunks = run_chunks(ctx, fn, q, NULL, reduce_task, &n);
+
+  // The elements now belong to the chunk results
+  q->count = 0;
+  lval_del(q);
+
+  lval* acc = chunks[0].result;
+  for (int i = 1; i < n; i++) {
+    if (acc->type == LVAL_ERR) {
+      lval_del(chunks[i].result);
+    } else {
+      acc = apply_fn(ctx, fn, acc, chunks[i].result);
+    }
+  }
+
+  free(chunks);
+  lval_del(fn);
+  return acc;
+}
+
+
+
+/*******************************************************************************
+ * builtin_future
+ * Starts evaluating a Q-Expression in the background.
+ *
+ * @desc The Q-Expression is evaluated as by `eval`, on the evaluation pool if
+ * parallel evaluation is enabled or on a dedicated worker otherwise.
+ *
+ * @param args - The Q-Expression to evaluate (at index 0).
+ *
+ * @return - Pointer to a handle on the pending value.
+ *
+ * @example
+ *
+ * touch (future {+ 1 2})
+ * // => 3
+ */
+lval* builtin_future(lispy_ctx* ctx, lval* args) {
+
+  // Ensure a single Q-Expression passed
+  L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_QEXPR, L_ERR_BAD_TYPE);
+
+  value v;
+  v.fut = future_new(ctx, lval_take(args, 0));
+  return make_lval(LVAL_FUTURE, v);
+}
+
+
+
+/*******************************************************************************
+ * builtin_touch
+ * Returns the value of a future, blocking until it is available.
+ *
+ * @param args - The future (at index 0) & optionally the most milliseconds to
+ *        wait (at index 1).
+ *
+ * @return - Pointer to the value, or an error if the future failed, was
+ *         cancelled or did not finish in time.
+ *
+ * @example
+ *
+ * touch (future {^ 2 100000}) 0
+ * // => Error: Future timed out
+ */
+lval* builtin_touch(lispy_ctx* ctx, lval* args) {
+
+  // Ensure a future & an optional timeout passed
+  L_ASSERT(args, args->count == 1 || args->count == 2, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_FUTURE, L_ERR_BAD_TYPE);
+
+  long timeout_ms = -1;
+  if (args->count == 2) {
+    L_ASSERT(args, args->val.cell[1]->type == LVAL_NUM, L_ERR_BAD_TYPE);
+    L_ASSERT(args, args->val.cell[1]->val.num >= 0, L_ERR_BAD_NUM);
+    timeout_ms = args->val.cell[1]->val.num;
+  }
+
+  lval* result = future_touch(args->val.cell[0]->val.fut, timeout_ms);
+  lval_del(args);
+  return result;
+}
+
+
+
+/*******************************************************************************
+ * builtin_cancel
+ * Cancels a future that has not started evaluating yet. Touching it afterwards
+ * gives a cancellation error.
+ *
+ * @param args - The future (at index 0).
+ *
+ * @return - Pointer to 1 if the future was cancelled, 0 if it already started.
+ */
+lval* builtin_cancel(lispy_ctx* ctx, lval* args) {
+
+  // Ensure a single future passed
+  L_ASSERT(args, args->count == 1, L_ERR_ARG_COUNT);
+  L_ASSERT(args, args->val.cell[0]->type == LVAL_FUTURE, L_ERR_BAD_TYPE);
+
+  value v;
+  v.num = future_cancel(args->val.cell[0]->val.fut);
+  lval_del(args);
+  return make_lval(LVAL_NUM, v);
+}
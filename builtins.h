@@ -3,16 +3,56 @@
 
 #include "lvals.h"
 
-lval* builtin(lval* a, char* func);
+extern char* builtin_names[];
+extern lbuiltin builtinFn[];
+extern char* operator_names[];
+extern char* special_names[];
+extern lbuiltin specialFn[];
+
+/**
+ * Default number of elements `pmap`, `pfilter` & `preduce` hand to each task.
+ */
+#ifndef BUILTIN_MAP_CHUNK
+#define BUILTIN_MAP_CHUNK 64
+#endif
+
+lval* builtin(lispy_ctx* ctx, lval* a, char* func);
 
 lval* builtin_op(lval*, char*);
+int fix_op(char* op, long x, long y, long* r);
+bignum* big_op(char* op, bignum* x, bignum* y);
+
+lval* builtin_head(lispy_ctx*, lval*);
+lval* builtin_tail(lispy_ctx*, lval*);
+lval* builtin_list(lispy_ctx*, lval*);
+lval* builtin_eval(lispy_ctx*, lval*);
+lval* builtin_init(lispy_ctx*, lval*);
+lval* builtin_cons(lispy_ctx*, lval*);
+lval* builtin_len(lispy_ctx*, lval*);
+
+lval* builtin_ord(lval*, char*);
+lval* builtin_cmp(lval*, char*);
+lval* builtin_gt(lispy_ctx*, lval*);
+lval* builtin_lt(lispy_ctx*, lval*);
+lval* builtin_ge(lispy_ctx*, lval*);
+lval* builtin_le(lispy_ctx*, lval*);
+lval* builtin_eq(lispy_ctx*, lval*);
+lval* builtin_ne(lispy_ctx*, lval*);
+
+int is_special(lispy_ctx* ctx, char* func);
+lval* special(lispy_ctx* ctx, lval* a, char* form);
+
+lval* builtin_if(lispy_ctx*, lval*);
+lval* builtin_and(lispy_ctx*, lval*);
+lval* builtin_or(lispy_ctx*, lval*);
+lval* builtin_when(lispy_ctx*, lval*);
+
+lval* builtin_pmap(lispy_ctx*, lval*);
+lval* builtin_pfilter(lispy_ctx*, lval*);
+lval* builtin_preduce(lispy_ctx*, lval*);
 
-lval* builtin_head(lval*);
-lval* builtin_tail(lval*);
-lval* builtin_list(lval*);
-lval* builtin_eval(lval*);
-lval* builtin_init(lval*);
-lval* builtin_cons(lval*);
-lval* builtin_len(lval*);
+lval* builtin_future(lispy_ctx*, lval*);
+lval* builtin_touch(lispy_ctx*, lval*);
+lval* builtin_cancel(lispy_ctx*, lval*);
 
 #endif
@@ -0,0 +1,379 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "context.h"
+#include "reader.h"
+
+static pthread_once_t lval_init_once = PTHREAD_ONCE_INIT;
+
+/*******************************************************************************
+ * lispy_ctx_new
+ * Creates an interpreter context with its own parsers & default builtins.
+ * Parallel evaluation starts disabled.
+ *
+ * @return ctx - Pointer to the new context.
+ */
+lispy_ctx* lispy_ctx_new(void) {
+
+  pthread_once(&lval_init_once, lval_init);
+
+  lispy_ctx* ctx = calloc(1, sizeof(lispy_ctx));
+
+  ctx->Number = mpc_new("number");
+  ctx->Symbol = mpc_new("symbol");
+  ctx->Expr = mpc_new("expr");
+  ctx->Sexpr = mpc_new("sexpr");
+  ctx->Qexpr = mpc_new("qexpr");
+  ctx->Lispy = mpc_new("lispy");
+
+  // Literals & regexes are matched against tokens lexed ahead of the parser
+  mpca_lang(MPCA_LANG_TOKENIZE,
+    " number : /-?[0-9]+(\\.[0-9]+)?/;                               \
+      symbol : '+' | '-' | '*' | '/' | '%' | '^' | /m((in)|(ax))/    \
+             | \"head\" | \"tail\" | \"list\" | \"eval\" | \"init\"  \
+             | \"cons\" | \"len\" | \"if\" | \"and\" | \"or\"        \
+             | \"when\" | \">=\" | \"<=\" | \"==\" | \"!=\"          \
+             | \"pmap\" | \"pfilter\" | \"preduce\" | \"future\"     \
+             | \"touch\" | \"cancel\"                                \
+             | '>' | '<';                                            \
+      expr   : <number> | <symbol> | <sexpr> | <qexpr>;              \
+      sexpr  : '(' <expr>* ')';                                      \
+      qexpr  : '{' <expr>* '}';                                      \
+      lispy  : /^/ <expr>* /$/;                                      \
+    ",
+    ctx->Number, ctx->Symbol, ctx->Expr, ctx->Sexpr, ctx->Qexpr, ctx->Lispy
+  );
+
+  // Nodes are told apart by the bits of the rules they matched
+  ctx->number_rule = mpca_rule(ctx->Number);
+  ctx->symbol_rule = mpca_rule(ctx->Symbol);
+  ctx->expr_rule = mpca_rule(ctx->Expr);
+  ctx->qexpr_rule = mpca_rule(ctx->Qexpr);
+
+  ctx->builtin_names = builtin_names;
+  ctx->builtin_fns = builtinFn;
+  ctx->special_names = special_names;
+  ctx->special_fns = specialFn;
+
+  ctx->split_cost = LVAL_SPLIT_COST;
+  ctx->map_chunk = BUILTIN_MAP_CHUNK;
+
+  return ctx;
+}
+
+
+
+/*******************************************************************************
+ * lispy_ctx_del
+ * Deletes a context along with its parsers, pools & interned symbols.
+ *
+ * @desc Every evaluation in the context must have finished, including futures,
+ * & no lval read in the context may be used afterwards.
+ */
+void lispy_ctx_del(lispy_ctx* ctx) {
+  mpc_cleanup(6, ctx->Number, ctx->Symbol, ctx->Expr, ctx->Sexpr, ctx->Qexpr, ctx->Lispy);
+  for (int i = 0; i < ctx->symbols_count; i++) { free(ctx->symbols[i]); }
+  free(ctx->symbols);
+  if (ctx->pool) { pool_del(ctx->pool); }
+  if (ctx->background) { pool_del(ctx->background); }
+  free(ctx);
+}
+
+
+
+/*******************************************************************************
+ * lispy_ctx_parallel
+ * Enables or disables parallel evaluation in a context.
+ *
+ * @desc The thread evaluating also works on its own splits, so the context's
+ * pool gets one thread fewer than asked for.
+ *
+ * @param ctx - Pointer to the context. Must not be evaluating.
+ * @param threads - Total threads to evaluate with. 1 or fewer disables.
+ * @param split_cost - Minimum estimated cost (see `lval_cost`) of an argument
+ *        before it is handed to another thread.
+ */
+void lispy_ctx_parallel(lispy_ctx* ctx, int threads, int split_cost) {
+  if (ctx->pool) { pool_del(ctx->pool); }
+  ctx->pool = threads > 1 ? pool_new(threads - 1) : NULL;
+  ctx->split_cost = split_cost;
+}
+
+
+
+/*******************************************************************************
+ * lispy_ctx_map_chunk
+ * Sets the number of elements each `pmap`, `pfilter` & `preduce` task gets.
+ *
+ * @desc Larger chunks mean fewer tasks & less overhead; smaller chunks balance
+ * uneven work across threads better.
+ */
+void lispy_ctx_map_chunk(lispy_ctx* ctx, int chunk) {
+  ctx->map_chunk = chunk > 0 ? chunk : 1;
+}
+
+
+
+/*******************************************************************************
+ * lispy_ctx_background
+ * Returns the context's single-threaded background pool, starting it on first
+ * use. Futures run here when parallel evaluation is disabled.
+ */
+pool* lispy_ctx_background(lispy_ctx* ctx) {
+
+  pool* p = __atomic_load_n(&ctx->background, __ATOMIC_ACQUIRE);
+  if (p) { return p; }
+
+  // Threads racing to start it keep whichever pool was published first
+  pool* fresh = pool_new(1);
+  if (__atomic_compare_exchange_n(&ctx->background, &p, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return fresh;
+  }
+  pool_del(fresh);
+  return p;
+}
+
+
+
+/*******************************************************************************
+ * lispy_intern
+ * Returns the unique copy of a symbol's name.
+ *
+ * @desc Names of operators, builtins & special forms are their table entries;
+ * any other name is copied into the context once. Symbol lvals point at the
+ * interned name, so reading & copying them never copies strings.
+ *
+ * @param ctx - Pointer to the context. Only the thread reading may intern.
+ * @param s - Pointer to the name, which need not be NUL-terminated.
+ * @param len - Length of the name.
+ *
+ * @return - Pointer to the interned name, valid as long as the context.
+ */
+char* lispy_intern(lispy_ctx* ctx, const char* s, size_t len) {
+
+  char** tables[] = { operator_names, ctx->builtin_names, ctx->special_names };
+  for (int t = 0; t < 3; t++) {
+    for (int i = 0; tables[t][i] != NULL; i++) {
+      if (strncmp(tables[t][i], s, len) == 0 && tables[t][i][len] == '\0') { return tables[t][i]; }
+    }
+  }
+
+  for (int i = 0; i < ctx->symbols_count; i++) {
+    if (strncmp(ctx->symbols[i], s, len) == 0 && ctx->symbols[i][len] == '\0') { return ctx->symbols[i]; }
+  }
+
+  char* name = malloc(len + 1);
+  memcpy(name, s, len);
+  name[len] = '\0';
+
+  ctx->symbols = realloc(ctx->symbols, sizeof(char*) * (ctx->symbols_count + 1));
+  ctx->symbols[ctx->symbols_count++] = name;
+  return name;
+}
+
+
+
+/*******************************************************************************
+ * read_events
+ * Takes the S-Expression built from a parse's rule events, or its error.
+ */
+static lval* read_events(lval_events* e, int ok, mpc_result_t* r, char** err) {
+  lval* x = NULL;
+  if (ok) {
+    x = e->vals[0];
+    *err = NULL;
+  } else {
+    *err = mpc_err_string(r->error);
+    mpc_err_delete(r->error);
+    // ...dropping whatever was read before the error
+    for (int i = 0; i < e->count; i++) { lval_del(e->vals[i]); }
+  }
+  free(e->vals);
+  free(e->starts);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * lispy_read
+ * Reads source code into an S-Expression with the context's chosen reader.
+ *
+ * @param ctx - Pointer to the context.
+ * @param filename - Name of the input, for error messages.
+ * @param src - The source code.
+ * @param err - Set to a description of the error on failure. Must be freed by
+ *        the caller.
+ *
+ * @return - Pointer to the S-Expression read, or NULL on error.
+ */
+lval* lispy_read(lispy_ctx* ctx, const char* filename, const char* src, char** err) {
+
+  if (ctx->hand_reader) { return reader_read(ctx, filename, src, strlen(src), err); }
+
+  lval_events e = { ctx, NULL, NULL, 0, 0 };
+  mpc_result_t r;
+  int ok = mpca_parse_events(filename, src, ctx->Lispy, lval_read_event, &e, &r);
+  return read_events(&e, ok, &r, err);
+}
+
+
+
+/*******************************************************************************
+ * read_all
+ * Reads the rest of a file into a new buffer, which the caller must free.
+ */
+static char* read_all(FILE* f, size_t* len) {
+  char* buffer = NULL;
+  size_t slots = 0;
+  size_t n = 1;
+  *len = 0;
+  while (n > 0) {
+    if (*len == slots) {
+      slots = slots ? slots * 2 : 4096;
+      buffer = realloc(buffer, slots);
+    }
+    n = fread(buffer + *len, 1, slots - *len, f);
+    *len += n;
+  }
+  return buffer;
+}
+
+
+
+/*******************************************************************************
+ * lispy_read_file
+ * Reads a whole file into an S-Expression with the context's chosen reader.
+ *
+ * @desc Regular files are memory-mapped & read in place by either reader. Any
+ * other file, such as a pipe, is read through stdio.
+ *
+ * @param ctx - Pointer to the context.
+ * @param filename - Path of the file.
+ * @param err - Set to a description of the error on failure. Must be freed by
+ *        the caller.
+ *
+ * @return - Pointer to the S-Expression read, or NULL on error.
+ */
+lval* lispy_read_file(lispy_ctx* ctx, const char* filename, char** err) {
+
+  if (!ctx->hand_reader) {
+    lval_events e = { ctx, NULL, NULL, 0, 0 };
+    mpc_result_t r;
+    int ok = mpca_parse_contents_events(filename, ctx->Lispy, lval_read_event, &e, &r);
+    return read_events(&e, ok, &r, err);
+  }
+
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) { close(fd); }
+    *err = malloc(strlen(filename) + 32);
+    sprintf(*err, "%s: error: Unable to open file!\n", filename);
+    return NULL;
+  }
+
+  lval* x;
+  char* map = MAP_FAILED;
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+
+  if (map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+    x = reader_read(ctx, filename, map, st.st_size, err);
+    munmap(map, st.st_size);
+  } else {
+    // Not mappable - collect the contents in memory first
+    FILE* f = fdopen(dup(fd), "rb");
+    size_t len;
+    char* buffer = read_all(f, &len);
+    fclose(f);
+    x = reader_read(ctx, filename, buffer, len, err);
+    free(buffer);
+  }
+
+  close(fd);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * read_each_ast
+ * Passes each expression parsed from a stream on to the reader's callback.
+ */
+typedef struct read_each_state {
+  lispy_ctx* ctx;
+  void (*fn)(lispy_ctx*, lval*, void*);
+  void* data;
+} read_each_state;
+
+static int read_each_ast(mpc_val_t* ast, void* data) {
+  read_each_state* s = data;
+  // The end of input matches as a NULL expression
+  if (ast) {
+    lval* x = lval_read(s->ctx, ast);
+    mpc_ast_delete(ast);
+    s->fn(s->ctx, x, s->data);
+  }
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * lispy_read_each
+ * Reads top-level expressions from a stream one at a time, handing each to a
+ * callback as soon as it has been read.
+ *
+ * @desc With the mpc reader only the expression being read is held in memory,
+ * so arbitrarily long streams can be piped through. The single-pass reader
+ * needs the whole source & reads the stream to its end first.
+ *
+ * @param ctx - Pointer to the context.
+ * @param filename - Name of the input, for error messages.
+ * @param f - The stream to read, e.g. `stdin`.
+ * @param fn - Called with each expression read, which it takes ownership of.
+ * @param data - Passed on to `fn`.
+ * @param err - Set to a description of the error on failure. Must be freed by
+ *        the caller. Expressions before the error have already been handed on.
+ *
+ * @return - 1 if the whole stream was read, 0 on error.
+ *
+ * @example - `lispy_read_each(ctx, "<stdin>", stdin, print_result, NULL, &err)`
+ */
+int lispy_read_each(lispy_ctx* ctx, const char* filename, FILE* f,
+                    void (*fn)(lispy_ctx*, lval*, void*), void* data, char** err) {
+
+  *err = NULL;
+
+  if (ctx->hand_reader) {
+    size_t len;
+    char* buffer = read_all(f, &len);
+    lval* x = reader_read(ctx, filename, buffer, len, err);
+    free(buffer);
+    if (!x) { return 0; }
+    while (x->count) { fn(ctx, lval_pop(x, 0), data); }
+    lval_del(x);
+    return 1;
+  }
+
+  // `expr` strips only the whitespace after it, so skip any before it first
+  mpc_parser_t* form = mpc_and(2, mpcf_snd_free,
+    mpc_whitespaces(), mpc_or(2, ctx->Expr, mpc_eoi()), free);
+
+  read_each_state s = { ctx, fn, data };
+  mpc_result_t r;
+  int ok = mpc_parse_pipe_each(filename, f, form, read_each_ast, &s, &r);
+  if (!ok) {
+    *err = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+  }
+
+  mpc_delete(form);
+  return ok;
+}
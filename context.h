@@ -0,0 +1,76 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "mpc/mpc.h"
+#include "lvals.h"
+
+/**
+ * lispy_stats
+ * Counters kept per context. Updated with relaxed atomics as a context's pool
+ * threads share them.
+ */
+typedef struct lispy_stats {
+  long evals;
+  long builtins;
+  long splits;
+  long futures;
+} lispy_stats;
+
+/**
+ * LISPY_STAT
+ * Increments the named counter of a context's statistics.
+ */
+#define LISPY_STAT(ctx, counter) __atomic_add_fetch(&(ctx)->stats.counter, 1, __ATOMIC_RELAXED)
+
+/**
+ * lispy_ctx
+ * All mutable interpreter state. Contexts share nothing but the immutable
+ * immortal lvals, so each thread may run its own context without locking.
+ *
+ * Source is read with the mpc grammar unless `hand_reader` is set, in which
+ * case the single-pass reader of reader.c is used instead.
+ *
+ * The builtin & special form tables default to those of builtins.c and may be
+ * replaced, e.g. to give a sandboxed context fewer builtins. Symbols naming
+ * neither an operator nor a table entry are interned in `symbols`.
+ */
+struct lispy_ctx {
+  mpc_parser_t* Number;
+  mpc_parser_t* Symbol;
+  mpc_parser_t* Expr;
+  mpc_parser_t* Sexpr;
+  mpc_parser_t* Qexpr;
+  mpc_parser_t* Lispy;
+  unsigned long number_rule;
+  unsigned long symbol_rule;
+  unsigned long expr_rule;
+  unsigned long qexpr_rule;
+  int hand_reader;
+
+  char** builtin_names;
+  lbuiltin* builtin_fns;
+  char** special_names;
+  lbuiltin* special_fns;
+  char** symbols;
+  int symbols_count;
+
+  pool* pool;
+  int split_cost;
+  int map_chunk;
+  pool* background;
+
+  lispy_stats stats;
+};
+
+lispy_ctx* lispy_ctx_new(void);
+void lispy_ctx_del(lispy_ctx* ctx);
+void lispy_ctx_parallel(lispy_ctx* ctx, int threads, int split_cost);
+void lispy_ctx_map_chunk(lispy_ctx* ctx, int chunk);
+pool* lispy_ctx_background(lispy_ctx* ctx);
+char* lispy_intern(lispy_ctx* ctx, const char* s, size_t len);
+lval* lispy_read(lispy_ctx* ctx, const char* filename, const char* src, char** err);
+lval* lispy_read_file(lispy_ctx* ctx, const char* filename, char** err);
+int lispy_read_each(lispy_ctx* ctx, const char* filename, FILE* f,
+                    void (*fn)(lispy_ctx*, lval*, void*), void* data, char** err);
+
+#endif
@@ -0,0 +1,207 @@
+#include <errno.h>
+#include <time.h>
+#include "future.h"
+#include "context.h"
+
+/*******************************************************************************
+ * future_claim
+ * Moves a pending future to running. Returns 1 if the calling thread claimed
+ * it & must now evaluate it, 0 if it was already claimed or cancelled.
+ */
+static int future_claim(future* f) {
+  pthread_mutex_lock(&f->lock);
+  int claimed = f->state == FUTURE_PENDING;
+  if (claimed) { f->state = FUTURE_RUNNING; }
+  pthread_mutex_unlock(&f->lock);
+  return claimed;
+}
+
+
+
+/*******************************************************************************
+ * future_settle
+ * Stores the result of a future & wakes every thread touching it.
+ */
+static void future_settle(future* f, int state, lval* result) {
+  pthread_mutex_lock(&f->lock);
+  f->state = state;
+  f->result = result;
+  pthread_cond_broadcast(&f->settled);
+  pthread_mutex_unlock(&f->lock);
+}
+
+
+
+/*******************************************************************************
+ * future_eval
+ * Evaluates a claimed future through `builtin_eval`.
+ */
+static void future_eval(future* f) {
+
+  value _;
+  _.num = 0;
+  lval* args = lval_add(make_lval(LVAL_SEXPR, _), f->expr);
+  f->expr = NULL;
+
+  future_settle(f, FUTURE_DONE, builtin_eval(f->ctx, args));
+}
+
+
+
+/*******************************************************************************
+ * future_run
+ * Pool entry point. Drops the queue's reference once done.
+ */
+static void future_run(void* arg) {
+  future* f = arg;
+  if (future_claim(f)) { future_eval(f); }
+  future_release(f);
+}
+
+
+
+/*******************************************************************************
+ * future_new
+ * Starts evaluating a Q-Expression in the background.
+ *
+ * @desc Evaluation happens on the context's pool if parallel evaluation is
+ * enabled, otherwise on its background worker.
+ *
+ * @param ctx - Pointer to the context to evaluate in.
+ * @param expr - Pointer to the Q-Expression. Consumed.
+ *
+ * @return - Pointer to the future, holding one reference for the caller.
+ */
+future* future_new(lispy_ctx* ctx, lval* expr) {
+
+  future* f = malloc(sizeof(future));
+  f->refs = 2;
+  f->ctx = ctx;
+  f->state = FUTURE_PENDING;
+  f->expr = expr;
+  f->result = NULL;
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->settled, NULL);
+
+  pool_spawn(ctx->pool ? ctx->pool : lispy_ctx_background(ctx), future_run, f);
+  LISPY_STAT(ctx, futures);
+
+  return f;
+}
+
+
+
+/*******************************************************************************
+ * future_retain
+ * Takes another reference to a future.
+ */
+future* future_retain(future* f) {
+  __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+  return f;
+}
+
+
+
+/*******************************************************************************
+ * future_release
+ * Drops a reference to a future, freeing it with the last one.
+ */
+void future_release(future* f) {
+
+  if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0) { return; }
+
+  if (f->expr) { lval_del(f->expr); }
+  if (f->result) { lval_del(f->result); }
+  pthread_mutex_destroy(&f->lock);
+  pthread_cond_destroy(&f->settled);
+  free(f);
+}
+
+
+
+/*******************************************************************************
+ * future_state
+ * Returns the current `future_states` value of a future.
+ */
+int future_state(future* f) {
+  pthread_mutex_lock(&f->lock);
+  int state = f->state;
+  pthread_mutex_unlock(&f->lock);
+  return state;
+}
+
+
+
+/*******************************************************************************
+ * future_touch
+ * Returns the value of a future, waiting for it if necessary.
+ *
+ * @desc Without a timeout a future that no worker has claimed yet is evaluated
+ * by the calling thread, so touching never waits on a busy pool. With a
+ * timeout the caller only waits, as evaluating could overrun it.
+ *
+ * @param f - Pointer to the future.
+ * @param timeout_ms - Milliseconds to wait at most, or negative to wait as long
+ *        as it takes.
+ *
+ * @return - Pointer to a copy of the value, a cancellation error, or a timeout
+ *         error if the future is still running.
+ */
+lval* future_touch(future* f, long timeout_ms) {
+
+  if (timeout_ms < 0 && future_claim(f)) { future_eval(f); }
+
+  struct timespec deadline;
+  if (timeout_ms >= 0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  pthread_mutex_lock(&f->lock);
+  int timed_out = 0;
+  while (!timed_out && f->state != FUTURE_DONE && f->state != FUTURE_CANCELLED) {
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&f->settled, &f->lock);
+    } else {
+      timed_out = pthread_cond_timedwait(&f->settled, &f->lock, &deadline) == ETIMEDOUT;
+    }
+  }
+
+  lval* result;
+  if (f->state == FUTURE_DONE || f->state == FUTURE_CANCELLED) {
+    result = lval_copy(f->result);
+  } else {
+    value e;
+    e.err = L_ERR_TIMEOUT;
+    result = make_lval(LVAL_ERR, e);
+  }
+  pthread_mutex_unlock(&f->lock);
+
+  return result;
+}
+
+
+
+/*******************************************************************************
+ * future_cancel
+ * Cancels a future that has not started evaluating yet.
+ *
+ * @return - 1 if the future was cancelled, 0 if it had already started.
+ */
+int future_cancel(future* f) {
+
+  if (!future_claim(f)) { return 0; }
+
+  lval_del(f->expr);
+  f->expr = NULL;
+
+  value e;
+  e.err = L_ERR_CANCELLED;
+  future_settle(f, FUTURE_CANCELLED, make_lval(LVAL_ERR, e));
+  return 1;
+}
@@ -0,0 +1,42 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include <pthread.h>
+#include "types.h"
+#include "pool.h"
+
+/**
+ * future_states
+ * Lifecycle of a future. Pending futures may be cancelled, or claimed by a
+ * worker or by the first thread to `touch` them.
+ */
+enum future_states {
+  FUTURE_PENDING,
+  FUTURE_RUNNING,
+  FUTURE_DONE,
+  FUTURE_CANCELLED
+};
+
+/**
+ * future
+ * A Q-Expression being evaluated in the background. Shared by every lval
+ * handle to it & by the queued task, each holding one reference.
+ */
+typedef struct future {
+  int refs;
+  lispy_ctx* ctx;
+  int state;
+  lval* expr;
+  lval* result;
+  pthread_mutex_t lock;
+  pthread_cond_t settled;
+} future;
+
+future* future_new(lispy_ctx* ctx, lval* expr);
+future* future_retain(future* f);
+void future_release(future* f);
+int future_state(future* f);
+lval* future_touch(future* f, long timeout_ms);
+int future_cancel(future* f);
+
+#endif
@@ -0,0 +1,86 @@
+#include "lispy.h"
+#include "context.h"
+
+/*******************************************************************************
+ * lispy_compile
+ * Parses source code once into a reusable expression.
+ *
+ * @param ctx - Pointer to the context to parse & later evaluate in.
+ * @param src - The source, read as a line typed at the REPL: `+ 1 2` & `(+ 1 2)`
+ *        are both valid.
+ * @param err - If not NULL, set to a description of the parse error on failure.
+ *        Must be freed by the caller.
+ *
+ * @return - Pointer to the compiled expression, or NULL if `src` does not parse.
+ */
+lispy_expr* lispy_compile(lispy_ctx* ctx, const char* src, char** err) {
+
+  char* msg;
+  lval* code = lispy_read(ctx, "<lispy>", src, &msg);
+  if (!code) {
+    if (err) { *err = msg; } else { free(msg); }
+    return NULL;
+  }
+
+  lispy_expr* e = malloc(sizeof(lispy_expr));
+  e->ctx = ctx;
+  e->code = code;
+
+  if (err) { *err = NULL; }
+  return e;
+}
+
+
+
+/*******************************************************************************
+ * lispy_eval
+ * Evaluates a compiled expression without parsing it again.
+ *
+ * @desc The arguments are appended to the top-level expression before it is
+ * evaluated, so `max 100` evaluated with {250} computes `max 100 250`. The
+ * compiled expression itself is left untouched & may be evaluated from several
+ * threads at once.
+ *
+ * @param e - Pointer to the compiled expression.
+ * @param args - Pointer to a Q-Expression of arguments, or NULL. Consumed.
+ *
+ * @return - Pointer to the result of evaluation. Must be deleted by the caller.
+ */
+lval* lispy_eval(lispy_expr* e, lval* args) {
+
+  lval* x = lval_copy(e->code);
+
+  // An empty `args` may be the shared immortal, so it is never written to
+  if (args && args->count > 0) {
+    for (int i = 0; i < args->count; i++) {
+      x = lval_add(x, args->val.cell[i]);
+    }
+    args->count = 0;
+  }
+  if (args) { lval_del(args); }
+
+  return lval_eval(e->ctx, x);
+}
+
+
+
+/*******************************************************************************
+ * lispy_args
+ * Returns an empty Q-Expression to collect arguments in with `lval_add`.
+ */
+lval* lispy_args(void) {
+  value _;
+  _.num = 0;
+  return make_lval(LVAL_QEXPR, _);
+}
+
+
+
+/*******************************************************************************
+ * lispy_expr_del
+ * Deletes a compiled expression. Its context is left alone.
+ */
+void lispy_expr_del(lispy_expr* e) {
+  lval_del(e->code);
+  free(e);
+}
@@ -0,0 +1,60 @@
+#ifndef LISPY_H
+#define LISPY_H
+
+/**
+ * liblispy
+ * Embedding API: compile an expression once, evaluate it many times.
+ *
+ * Build the static & shared libraries from the repository root with:
+ *
+ *   cc -std=gnu99 -O2 -fPIC -c lispy.c context.c reader.c lvals.c builtins.c \
+ *      future.c pool.c bignum.c utils.c mpc/mpc.c
+ *   ar rcs liblispy.a lispy.o context.o reader.o lvals.o builtins.o future.o \
+ *      pool.o bignum.o utils.o mpc.o
+ *   cc -shared -o liblispy.so lispy.o context.o reader.o lvals.o builtins.o \
+ *      future.o pool.o bignum.o utils.o mpc.o -lm -lpthread
+ *
+ * and link hosts with `-llispy -lm -lpthread`.
+ *
+ * @example
+ *
+ * lispy_ctx* ctx = lispy_ctx_new();
+ * lispy_expr* rule = lispy_compile(ctx, "max 100", NULL);
+ *
+ * value v;
+ * v.num = 250;
+ * lval* args = lval_add(lispy_args(), make_lval(LVAL_NUM, v));
+ *
+ * lval* r = lispy_eval(rule, args);
+ * // => 250
+ */
+
+#include "types.h"
+
+/**
+ * The parts of the interpreter hosts need. `types.h` declares `lispy_ctx` as
+ * an opaque type & defines `lval` & `value`; the rest of the interpreter, mpc
+ * included, stays out of the public header.
+ */
+lispy_ctx* lispy_ctx_new(void);
+void lispy_ctx_del(lispy_ctx* ctx);
+lval* make_lval(int type, value x);
+lval* lval_add(lval* s_expr, lval* new_lval);
+void lval_del(lval* v);
+void lval_println(lval* v);
+
+/**
+ * lispy_expr
+ * A compiled expression, bound to the context it was compiled in.
+ */
+typedef struct lispy_expr {
+  lispy_ctx* ctx;
+  lval* code;
+} lispy_expr;
+
+lispy_expr* lispy_compile(lispy_ctx* ctx, const char* src, char** err);
+lval* lispy_eval(lispy_expr* e, lval* args);
+lval* lispy_args(void);
+void lispy_expr_del(lispy_expr* e);
+
+#endif
@@ -1,30 +1,156 @@
-#include "lvals.h"
+#include "context.h"
+
+#define LVAL_SMALL_INT_NUM (LVAL_SMALL_INT_MAX - LVAL_SMALL_INT_MIN + 1)
+#define LVAL_IMMORTAL_NUM (L_ERR_COUNT + 2 + LVAL_SMALL_INT_NUM)
+
+/**
+ * immortals
+ * Statically allocated lvals shared by every reference to them: one error per
+ * `lval_errors` code, the empty S & Q-Expressions, then the small integers.
+ * They are never mutated and `lval_del` ignores them.
+ */
+static lval immortals[LVAL_IMMORTAL_NUM];
+
+/**
+ * lval_free_list
+ * Per-thread cache of released lval structs, linked through `val.cell`. Each
+ * thread allocates from & releases to its own list without locking; lvals
+ * released by a thread other than the one that made them simply change lists.
+ */
+static __thread lval* lval_free_list = NULL;
+static __thread int lval_free_count = 0;
+static pthread_key_t lval_free_key;
+
+#define IMMORTAL_ERR(e) (&immortals[(e)])
+#define IMMORTAL_SEXPR (&immortals[L_ERR_COUNT])
+#define IMMORTAL_QEXPR (&immortals[L_ERR_COUNT + 1])
+#define IMMORTAL_INT(n) (&immortals[L_ERR_COUNT + 2 + ((n) - LVAL_SMALL_INT_MIN)])
+
+/*******************************************************************************
+ * lval_free_flush
+ * Returns the calling thread's cached lvals to the system allocator. Runs
+ * automatically when a thread that released lvals exits.
+ */
+void lval_free_flush(void* unused) {
+  while (lval_free_list) {
+    lval* next = (lval*) lval_free_list->val.cell;
+    free(lval_free_list);
+    lval_free_list = next;
+  }
+  lval_free_count = 0;
+}
+
+
+
+/*******************************************************************************
+ * lval_alloc
+ * Allocates an uninitialised lval from the calling thread's free list.
+ */
+lval* lval_alloc(void) {
+  lval* v = lval_free_list;
+  if (!v) { return malloc(sizeof(lval)); }
+  lval_free_list = (lval*) v->val.cell;
+  lval_free_count--;
+  return v;
+}
+
+
+
+/*******************************************************************************
+ * lval_release
+ * Releases an lval struct to the calling thread's free list, or to the system
+ * allocator once the list holds `LVAL_FREE_MAX` entries.
+ */
+void lval_release(lval* v) {
+
+  if (lval_free_count >= LVAL_FREE_MAX) {
+    free(v);
+    return;
+  }
+
+  // Registering a non-NULL value makes the key's destructor run at thread exit
+  if (lval_free_count == 0) { pthread_setspecific(lval_free_key, v); }
+
+  v->val.cell = (lval**) lval_free_list;
+  lval_free_list = v;
+  lval_free_count++;
+}
+
+
+
+/*******************************************************************************
+ * lval_init
+ * Fills in the immortal lvals. Run once by the first `lispy_ctx_new`.
+ */
+void lval_init(void) {
+
+  pthread_key_create(&lval_free_key, lval_free_flush);
+
+  for (int i = 0; i < L_ERR_COUNT; i++) {
+    IMMORTAL_ERR(i)->type = LVAL_ERR;
+    IMMORTAL_ERR(i)->val.err = i;
+  }
+
+  IMMORTAL_SEXPR->type = LVAL_SEXPR;
+  IMMORTAL_SEXPR->val.cell = NULL;
+  IMMORTAL_SEXPR->count = 0;
+
+  IMMORTAL_QEXPR->type = LVAL_QEXPR;
+  IMMORTAL_QEXPR->val.cell = NULL;
+  IMMORTAL_QEXPR->count = 0;
+
+  for (long n = LVAL_SMALL_INT_MIN; n <= LVAL_SMALL_INT_MAX; n++) {
+    IMMORTAL_INT(n)->type = LVAL_NUM;
+    IMMORTAL_INT(n)->val.num = n;
+  }
+}
+
+
+
+/*******************************************************************************
+ * lval_is_immortal
+ * Returns 1 if given lval is one of the statically allocated immortals.
+ *
+ * @param v - Pointer to the lval to check.
+ */
+int lval_is_immortal(lval* v) {
+  return v >= &immortals[0] && v < &immortals[LVAL_IMMORTAL_NUM];
+}
+
+
 
 /*******************************************************************************
  * make_lval
  * Packages a given type and "raw" value as a valid lval.
  *
+ * @desc Errors, empty S/Q-Expressions & small integers are returned as shared
+ * immortals without allocating. Symbols are not copied: their name must be
+ * interned (see `lispy_intern`) or otherwise outlive the lval. Callers must
+ * therefore never mutate the result in place - `lval_add` takes care of growing
+ * an immortal empty expression.
+ *
  * @param {int} type [`LVAL_{NUM|ERR|SYM|SEXPR}`] - Type of lval to construct.
  * @param {value} x - The "raw" value of lval.
  * @return {lval*} v - Pointer to valid lval.
  */
 lval* make_lval(int type, value x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = type;
+
   switch (type) {
-    case LVAL_SYM:
-      v->val.sym = malloc(strlen(x.sym) + 1);
-      strcpy(v->val.sym, x.sym);
-    break;
-    case LVAL_QEXPR:
-    case LVAL_SEXPR:
-      v->count = 0;
-      v->val.cell = NULL;
+    case LVAL_ERR:
+      if (x.err >= 0 && x.err < L_ERR_COUNT) { return IMMORTAL_ERR(x.err); }
     break;
-    default:
-      v->val = x;
+    case LVAL_NUM:
+      if (x.num >= LVAL_SMALL_INT_MIN && x.num <= LVAL_SMALL_INT_MAX) { return IMMORTAL_INT(x.num); }
     break;
+    case LVAL_SEXPR:
+      return IMMORTAL_SEXPR;
+    case LVAL_QEXPR:
+      return IMMORTAL_QEXPR;
   }
+
+  lval* v = lval_alloc();
+  v->type = type;
+  v->val = x;
   return v;
 }
 
@@ -38,11 +164,10 @@ lval* make_lval(int type, value x) {
  */
 void lval_del(lval* v) {
 
+  // Immortals are shared & statically allocated
+  if (lval_is_immortal(v)) { return; }
+
   switch (v->type) {
-    case LVAL_SYM:
-      // If symbol free the string data
-      free(v->val.sym);
-    break;
     case LVAL_QEXPR:
     case LVAL_SEXPR:
       // If S-Expression or Q-Expression delete all elements inside
@@ -52,13 +177,49 @@ void lval_del(lval* v) {
       // Free memory allocated to contain the pointers
       free(v->val.cell);
     break;
+    case LVAL_BIG:
+      big_del(v->val.big);
+    break;
+    case LVAL_FUTURE:
+      future_release(v->val.fut);
+    break;
     case LVAL_NUM:
     case LVAL_ERR:
+    case LVAL_SYM:
+      // Symbol names are interned, not owned
     break;
   }
 
-  // Free memory allocated for lval itself
-  free(v);
+  // Release memory allocated for lval itself
+  lval_release(v);
+}
+
+
+
+/*******************************************************************************
+ * lval_expr
+ * Packages an array of lvals as an S or Q-Expression.
+ *
+ * @param type - `LVAL_SEXPR` or `LVAL_QEXPR`.
+ * @param cells - Pointer to a malloc'd array of lvals. Taken over.
+ * @param count - Number of lvals in `cells`.
+ *
+ * @return v - Pointer to the expression.
+ */
+lval* lval_expr(int type, lval** cells, int count) {
+
+  if (count == 0) {
+    free(cells);
+    value _;
+    _.num = 0;
+    return make_lval(type, _);
+  }
+
+  lval* v = lval_alloc();
+  v->type = type;
+  v->count = count;
+  v->val.cell = realloc(cells, sizeof(lval*) * count);
+  return v;
 }
 
 
@@ -67,12 +228,25 @@ void lval_del(lval* v) {
  * lval_add
  * Appends an lval to the given S-Expression's list of lvals.
  *
+ * @desc Always use the returned pointer: if `s_expr` is an immortal empty
+ * expression a new one is allocated.
+ *
  * @param s_expr - Pointer to the S-Expression being updated.
  * @param new_lval - Pointer to the lval to append.
  *
  * @return s_expr - Pointer to the updated S-Expression lval.
  */
 lval* lval_add(lval* s_expr, lval* new_lval) {
+
+  // Immortal empty expressions are shared - grow a fresh copy instead
+  if (lval_is_immortal(s_expr)) {
+    int type = s_expr->type;
+    s_expr = lval_alloc();
+    s_expr->type = type;
+    s_expr->count = 0;
+    s_expr->val.cell = NULL;
+  }
+
   s_expr->count++;
   s_expr->val.cell = realloc(s_expr->val.cell, (sizeof(lval*) * s_expr->count));
   s_expr->val.cell[(s_expr->count - 1)] = new_lval;
@@ -121,6 +295,12 @@ void lval_print(lval* v) {
     case LVAL_NUM:
       printf("%li", v->val.num);
     break;
+    case LVAL_BIG: {
+      char* digits = big_to_str(v->val.big);
+      printf("%s", digits);
+      free(digits);
+    }
+    break;
     case LVAL_ERR:
       switch (v->val.err) {
         case L_ERR_DIV_ZERO:
@@ -141,11 +321,25 @@ void lval_print(lval* v) {
         case L_ERR_EMPTY_Q:
           printf("Error: Function passed {}");
         break;
+        case L_ERR_TIMEOUT:
+          printf("Error: Future timed out");
+        break;
+        case L_ERR_CANCELLED:
+          printf("Error: Future cancelled");
+        break;
+        case L_ERR_TOO_LARGE:
+          printf("Error: Result too large");
+        break;
       }
     break;
     case LVAL_SYM:
       printf("%s", v->val.sym);
     break;
+    case LVAL_FUTURE: {
+      char* states[] = { "pending", "running", "done", "cancelled" };
+      printf("<future %s>", states[future_state(v->val.fut)]);
+    }
+    break;
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       print_expr(v);
@@ -168,44 +362,55 @@ void lval_println(lval* v) {
 
 
 
+/*******************************************************************************
+ * lval_read_number
+ * Reads the text of a number as a fixnum, or as a bignum when it's too large.
+ *
+ * @param s - The number's text, NUL-terminated.
+ * @param len - Length of the text.
+ */
+static lval* lval_read_number(const char* s, size_t len) {
+  value v;
+  // ...attempt conversion from string to long integer
+  errno = 0;
+  v.num = strtol(s, NULL, 10);
+  if (errno != ERANGE) { return make_lval(LVAL_NUM, v); }
+  // ...too large for a fixnum, read as a bignum
+  v.big = big_from_str(s, len);
+  return make_lval(LVAL_BIG, v);
+}
+
+
+
 /*******************************************************************************
  * lval_read
  * Converts an ast node to a valid Lispy lval.
  *
+ * @param ctx - Pointer to the context to intern symbols in.
  * @param t - The node to evaluate.
- *  field {char*} t.tag - The rule used to parse node.
+ *  field {unsigned long} t.rules - The rules used to parse node.
  *  field {char*} t.contents - The actual contents of the node.
  *  field {struct**} t.children - Node's child nodes.
  * @return {lval*} x - Pointer to lval constructed for given node.
  */
-lval* lval_read(mpc_ast_t* t) {
+lval* lval_read(lispy_ctx* ctx, mpc_ast_t* t) {
 
   value v;
+  v.num = 0;
   int type = LVAL_ERR;
 
-  int tag = get_lval_tag(t->tag);
+  int tag = get_lval_tag(ctx, t->rules);
   switch (tag) {
 
     // Node is a number
     case LVAL_NUM:
-      // ...attempt conversion from string to long integer
-      errno = 0;
-      v.num = strtol(t->contents, NULL, 10);
-      if (errno != ERANGE) {
-        // ...conversion successful, set type of value to NUM
-        type = LVAL_NUM;
-      } else {
-        // ...something went wrong, set type of value to ERR
-        type = LVAL_ERR;
-        v.err = L_ERR_BAD_NUM;
-      }
-    break;
+      return lval_read_number(t->contents, strlen(t->contents));
 
     // Node is a symbol
     case LVAL_SYM:
       // ...set type & value of lval
       type = LVAL_SYM;
-      v.sym = t->contents;
+      v.sym = lispy_intern(ctx, t->contents, strlen(t->contents));
     break;
 
     // Node is root or s-expression
@@ -231,11 +436,203 @@ lval* lval_read(mpc_ast_t* t) {
 
   // Convert child nodes to lvals & append to new lval
   for (int i = 0; i < t->children_num; i++) {
-    if (is_delimiter(t->children[i]->contents)) { continue; }
-    if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
-    x = lval_add(x, lval_read(t->children[i]));
+    // Delimiters & anchors match no rule of their own
+    if (t->children[i]->rules == 0) { continue; }
+    x = lval_add(x, lval_read(ctx, t->children[i]));
+  }
+
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * lval_read_event
+ * Builds lvals from the rule events of a parse with the Lispy grammar, in
+ * place of reading them from a tree. See `mpca_parse_events`.
+ *
+ * @desc A rule finishes after everything inside it, so numbers & symbols are
+ * pushed as they're read & an S or Q-Expression takes every value that started
+ * inside it as its cells. Once `lispy` finishes only the program is left.
+ *
+ * @param rule - Name of the rule matched.
+ * @param bit - Bit of the rule matched, told apart by the context's rule bits.
+ * @param start - Offset of the match in the source.
+ * @param end - Offset just past the match & any whitespace after it.
+ * @param text - Pointer to the start of the match.
+ * @param data - Pointer to the `lval_events` being built.
+ */
+void lval_read_event(const char* rule, unsigned long bit, long start, long end, const char* text, void* data) {
+
+  lval_events* e = data;
+  size_t len = end - start;
+  lval* x;
+
+  // An `expr`'s one value has already been read
+  if (bit & e->ctx->expr_rule) { return; }
+
+  while (len > 0 && isspace((unsigned char)text[len - 1])) { len--; }
+
+  int tag = get_lval_tag(e->ctx, bit);
+  switch (tag) {
+
+    case LVAL_NUM: {
+      // The source isn't NUL-terminated, so convert a copy
+      char buf[64];
+      char* s = len < sizeof(buf) ? buf : malloc(len + 1);
+      memcpy(s, text, len);
+      s[len] = '\0';
+      x = lval_read_number(s, len);
+      if (s != buf) { free(s); }
+    }
+    break;
+
+    case LVAL_SYM: {
+      value v;
+      v.sym = lispy_intern(e->ctx, text, len);
+      x = make_lval(LVAL_SYM, v);
+    }
+    break;
+
+    // S-Expressions, Q-Expressions & the program take the values inside them
+    default: {
+      int first = e->count;
+      while (first > 0 && e->starts[first - 1] >= start) { first--; }
+      int count = e->count - first;
+      lval** cells = count ? malloc(sizeof(lval*) * count) : NULL;
+      if (count) { memcpy(cells, e->vals + first, sizeof(lval*) * count); }
+      x = lval_expr(tag, cells, count);
+      e->count = first;
+    }
+    break;
   }
 
+  if (e->count == e->slots) {
+    e->slots = e->slots ? e->slots * 2 : 64;
+    e->vals = realloc(e->vals, sizeof(lval*) * e->slots);
+    e->starts = realloc(e->starts, sizeof(long) * e->slots);
+  }
+
+  e->vals[e->count] = x;
+  e->starts[e->count] = start;
+  e->count++;
+}
+
+
+
+/*******************************************************************************
+ * lval_eq
+ * Compares two lvals for structural equality.
+ *
+ * @param x - Pointer to the first lval.
+ * @param y - Pointer to the second lval.
+ *
+ * @return 1 if both lvals have the same type and contents, otherwise 0.
+ */
+int lval_eq(lval* x, lval* y) {
+
+  if (x->type != y->type) { return 0; }
+
+  switch (x->type) {
+    case LVAL_NUM:
+      return x->val.num == y->val.num;
+    case LVAL_BIG:
+      return big_cmp(x->val.big, y->val.big) == 0;
+    case LVAL_ERR:
+      return x->val.err == y->val.err;
+    case LVAL_SYM:
+      return strcmp(x->val.sym, y->val.sym) == 0;
+    case LVAL_FUTURE:
+      return x->val.fut == y->val.fut;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (x->count != y->count) { return 0; }
+      for (int i = 0; i < x->count; i++) {
+        if (!lval_eq(x->val.cell[i], y->val.cell[i])) { return 0; }
+      }
+      return 1;
+  }
+
+  return 0;
+}
+
+
+
+/*******************************************************************************
+ * lval_from_big
+ * Packages a bignum as an lval, demoting it to a fixnum if it fits in a long.
+ *
+ * @param b - Pointer to the bignum. Ownership passes to the returned lval.
+ * @return {lval*} - Pointer to a `LVAL_NUM` or `LVAL_BIG` lval.
+ */
+lval* lval_from_big(bignum* b) {
+  value v;
+  if (big_to_long(b, &v.num)) {
+    big_del(b);
+    return make_lval(LVAL_NUM, v);
+  }
+  v.big = b;
+  return make_lval(LVAL_BIG, v);
+}
+
+
+
+/*******************************************************************************
+ * lval_num_cmp
+ * Compares two numeric lvals of either representation.
+ *
+ * @desc A bignum always lies outside the range of a fixnum, so mixed
+ * comparisons only need the sign of the bignum.
+ *
+ * @return - Negative, zero or positive as `x` is less than, equal to or greater
+ *         than `y`.
+ */
+int lval_num_cmp(lval* x, lval* y) {
+  if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+    return (x->val.num > y->val.num) - (x->val.num < y->val.num);
+  }
+  if (x->type == LVAL_NUM) { return y->val.big->neg ? 1 : -1; }
+  if (y->type == LVAL_NUM) { return x->val.big->neg ? -1 : 1; }
+  return big_cmp(x->val.big, y->val.big);
+}
+
+
+
+/*******************************************************************************
+ * lval_copy
+ * Makes a deep copy of an lval.
+ *
+ * @desc Immortals are shared rather than copied.
+ *
+ * @param v - Pointer to the lval to copy.
+ *
+ * @return x - Pointer to the copy.
+ */
+lval* lval_copy(lval* v) {
+
+  if (lval_is_immortal(v)) { return v; }
+
+  lval* x = lval_alloc();
+  x->type = v->type;
+  switch (v->type) {
+    case LVAL_BIG:
+      x->val.big = big_copy(v->val.big);
+    break;
+    case LVAL_FUTURE:
+      x->val.fut = future_retain(v->val.fut);
+    break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      x->count = v->count;
+      x->val.cell = malloc(sizeof(lval*) * v->count);
+      for (int i = 0; i < v->count; i++) {
+        x->val.cell[i] = lval_copy(v->val.cell[i]);
+      }
+    break;
+    default:
+      x->val = v->val;
+    break;
+  }
   return x;
 }
 
@@ -289,26 +686,150 @@ lval* lval_take(lval* v, int i) {
 
 
 
+/*******************************************************************************
+ * lval_cost
+ * Estimates the work needed to evaluate an lval.
+ *
+ * @desc Counts the nodes of nested S-Expressions - Q-Expressions are not
+ * evaluated and count as one. Counting stops once `limit` is reached so the
+ * estimate itself stays cheap.
+ *
+ * @param v - Pointer to the lval.
+ * @param limit - The count at which to stop.
+ *
+ * @return - The estimated cost, at most `limit`.
+ */
+int lval_cost(lval* v, int limit) {
+  if (v->type != LVAL_SEXPR) { return 1; }
+  int cost = 1;
+  for (int i = 0; i < v->count && cost < limit; i++) {
+    cost += lval_cost(v->val.cell[i], limit - cost);
+  }
+  return cost < limit ? cost : limit;
+}
+
+
+
+/**
+ * eval_job
+ * A child of an S-Expression handed to another thread.
+ */
+typedef struct {
+  pool_task task;
+  lispy_ctx* ctx;
+  lval** slot;
+} eval_job;
+
+/*******************************************************************************
+ * eval_task
+ * Pool entry point - evaluates the job's lval slot in place.
+ */
+void eval_task(void* arg) {
+  eval_job* job = arg;
+  *job->slot = lval_eval(job->ctx, *job->slot);
+}
+
+
+
+/*******************************************************************************
+ * lval_eval_children_parallel
+ * Evaluates the children of an S-Expression, expensive ones on the pool.
+ *
+ * @desc Children whose estimated cost reaches the context's `split_cost` are
+ * submitted to the pool, except for the last one which is evaluated by the
+ * calling thread along with all cheap children. Special forms are never split
+ * as their arguments must not be evaluated eagerly.
+ *
+ * Every child ends up evaluated, so the caller's left-to-right scan for the
+ * first error returns the same error as sequential evaluation would.
+ *
+ * @param v - Pointer to the S-Expression whose children to evaluate.
+ *
+ * @return - 1 if all children were evaluated, 0 if splitting was not worth it
+ *         and nothing was evaluated.
+ */
+int lval_eval_children_parallel(lispy_ctx* ctx, lval* v) {
+
+  if (v->val.cell[0]->type == LVAL_SYM && is_special(ctx, v->val.cell[0]->val.sym)) { return 0; }
+
+  eval_job* jobs = NULL;
+  char* queued = NULL;
+  int spawned = 0;
+  int last = -1;
+
+  for (int i = 0; i < v->count; i++) {
+    if (lval_cost(v->val.cell[i], ctx->split_cost) < ctx->split_cost) { continue; }
+
+    // Hand the previous expensive child to the pool, keep this one for now
+    if (last >= 0) {
+      if (!jobs) {
+        jobs = malloc(sizeof(eval_job) * v->count);
+        queued = calloc(v->count, 1);
+      }
+      jobs[spawned].task.fn = eval_task;
+      jobs[spawned].task.arg = &jobs[spawned];
+      jobs[spawned].ctx = ctx;
+      jobs[spawned].slot = &v->val.cell[last];
+      queued[last] = 1;
+      pool_submit(ctx->pool, &jobs[spawned].task);
+      LISPY_STAT(ctx, splits);
+      spawned++;
+    }
+    last = i;
+  }
+
+  if (!spawned) { return 0; }
+
+  // Evaluate everything not submitted, then join
+  for (int i = 0; i < v->count; i++) {
+    if (!queued[i]) { v->val.cell[i] = lval_eval(ctx, v->val.cell[i]); }
+  }
+
+  for (int j = 0; j < spawned; j++) {
+    pool_wait(ctx->pool, &jobs[j].task);
+  }
+
+  free(jobs);
+  free(queued);
+  return 1;
+}
+
+
+
 /*******************************************************************************
  * lval_eval_sexpr
  * Evaluates a valid S-Expression.
  *
- * @desc We first evaluate all the children of the S-Expression. If any of these
+ * @desc If the first child names a special form, the remaining children are
+ * handed to it unevaluated. Otherwise we first evaluate all the children of the
+ * S-Expression, expensive ones in parallel if enabled. If any of these
  * children are errors we return the first error we encounter. If the S-Expression
  * has no children we just return it directly. If the S-Expression has a single
  * child that child is returned. Otherwise, we ensure the first child is a valid
  * symbol and, if so, perform the desired operation and return the result.
  *
+ * @param ctx - Pointer to the context to evaluate in.
  * @param v - Pointer to the S-Expression to evaluate.
  *
  * @return {lval*} - Pointer to the result of evaluation.
  */
-lval* lval_eval_sexpr(lval* v) {
+lval* lval_eval_sexpr(lispy_ctx* ctx, lval* v) {
+
+  LISPY_STAT(ctx, evals);
+
+  // Special forms are passed their arguments unevaluated
+  if (v->count > 1 && v->val.cell[0]->type == LVAL_SYM && is_special(ctx, v->val.cell[0]->val.sym)) {
+    lval* f = lval_pop(v, 0);
+    lval* result = special(ctx, v, f->val.sym);
+    lval_del(f);
+    return result;
+  }
 
-  // Evaluate children
+  // Evaluate children - expensive ones in parallel if enabled
+  int evaluated = ctx->pool && v->count > 1 && lval_eval_children_parallel(ctx, v);
   for (int i = 0; i < v->count; i++) {
 
-    v->val.cell[i] = lval_eval(v->val.cell[i]);
+    if (!evaluated) { v->val.cell[i] = lval_eval(ctx, v->val.cell[i]); }
 
     // Perform error check
     if (v->val.cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
@@ -331,7 +852,7 @@ lval* lval_eval_sexpr(lval* v) {
   }
 
   // Call builtin with operator
-  lval* result = builtin(v, f->val.sym);
+  lval* result = builtin(ctx, v, f->val.sym);
 
   lval_del(f);
   return result;
@@ -343,14 +864,15 @@ lval* lval_eval_sexpr(lval* v) {
  * lval_eval
  * Returns the result of evaluating a valid lval.
  *
+ * @param ctx - Pointer to the context to evaluate in.
  * @param v - Pointer to the lval to evaluate.
  * @return {lval*} result - Pointer to the result of evaluation.
  */
-lval* lval_eval(lval* v) {
+lval* lval_eval(lispy_ctx* ctx, lval* v) {
   lval* result = v;
   switch (v->type) {
     case LVAL_SEXPR:
-      result = lval_eval_sexpr(v);
+      result = lval_eval_sexpr(ctx, v);
     break;
     default:
       // All other lval types remain the same
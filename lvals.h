@@ -3,17 +3,78 @@
 
 #include "mpc/mpc.h"
 #include "types.h"
+#include "bignum.h"
+#include "pool.h"
+#include "future.h"
 #include "utils.h"
 #include "builtins.h"
 
+/**
+ * Range of integers served from the immortal small-integer cache.
+ * Override at compile time, e.g. `-DLVAL_SMALL_INT_MAX=65535`.
+ */
+#ifndef LVAL_SMALL_INT_MIN
+#define LVAL_SMALL_INT_MIN -128
+#endif
+
+#ifndef LVAL_SMALL_INT_MAX
+#define LVAL_SMALL_INT_MAX 1023
+#endif
+
+/**
+ * Default estimated cost (in nodes) an argument must reach before parallel
+ * evaluation hands it to another thread.
+ */
+#ifndef LVAL_SPLIT_COST
+#define LVAL_SPLIT_COST 256
+#endif
+
+/**
+ * Maximum number of released lvals each thread keeps for reuse.
+ */
+#ifndef LVAL_FREE_MAX
+#define LVAL_FREE_MAX 4096
+#endif
+
+/**
+ * LVAL_IS_NUM
+ * True for either representation of an integer: a fixnum (`LVAL_NUM`) or a
+ * bignum (`LVAL_BIG`). Bignums are only ever used for values outside the range
+ * of `long`.
+ */
+#define LVAL_IS_NUM(v) ((v)->type == LVAL_NUM || (v)->type == LVAL_BIG)
+
+/**
+ * lval_events
+ * Values read so far from a parse's rule events, with the offset each one
+ * started at. See `lval_read_event`.
+ */
+typedef struct lval_events {
+  lispy_ctx* ctx;
+  lval** vals;
+  long* starts;
+  int count;
+  int slots;
+} lval_events;
+
+void lval_init(void);
+int lval_is_immortal(lval* v);
+
 lval* make_lval(int type, value x);
 void lval_del(lval* v);
 lval* lval_add(lval* s_expr, lval* new_lval);
-lval* lval_read(mpc_ast_t* t);
+lval* lval_expr(int type, lval** cells, int count);
+lval* lval_read(lispy_ctx* ctx, mpc_ast_t* t);
+void lval_read_event(const char* rule, unsigned long bit, long start, long end, const char* text, void* data);
 void lval_println(lval* v);
-lval* lval_eval(lval* v);
+lval* lval_eval(lispy_ctx* ctx, lval* v);
+int lval_cost(lval* v, int limit);
 void lval_print(lval* v);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
+lval* lval_copy(lval* v);
+int lval_eq(lval* x, lval* y);
+lval* lval_from_big(bignum* b);
+int lval_num_cmp(lval* x, lval* y);
 
 #endif
@@ -1,4 +1,19 @@
 #include "mpc.h"
+#include <limits.h>
+#include <time.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define MPC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /*
 ** State Type
@@ -39,15 +54,17 @@ static mpc_state_t mpc_state_new(void) {
 ** by seeking in the file at different positions.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and 
-** only support a single character lookahead at 
-** any point, when the input is marked for a 
-** potential backtracking we start buffering any 
-** input.
+** one. As we assume pipes cannot be seeked, the
+** input is read in large blocks into a list of
+** fixed size chunks. Chunks are released once
+** they lie wholly before both the current
+** position and the oldest mark, so memory is
+** bounded by the largest region that may still
+** be backtracked over.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** chunks instead of the input.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -58,21 +75,145 @@ static mpc_state_t mpc_state_new(void) {
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/*
+** Each input owns a small pool of fixed size blocks
+** for the many tiny allocations made while parsing,
+** such as single characters & AST nodes. The pool is
+** split into size classes, given as X(block size,
+** block count). Block sizes must be multiples of the
+** pointer size & ascend. Requests larger than every
+** class, or made once a class & all larger ones are
+** exhausted, fall back to malloc.
+*/
+#ifndef MPC_MEM_CLASSES
+#define MPC_MEM_CLASSES(X) X(16, 512) X(64, 512)
+#endif
+
+#define MPC_MEM_COUNT_(size, num) + 1
+#define MPC_MEM_BYTES_(size, num) + (size) * (num)
+#define MPC_MEM_SIZE_(size, num) (size),
+#define MPC_MEM_NUM_(size, num) (num),
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_MEM_CLASS_NUM = 0 MPC_MEM_CLASSES(MPC_MEM_COUNT_)
 };
 
-typedef struct {
-  char mem[64];
+static const size_t mpc_mem_sizes[] = { MPC_MEM_CLASSES(MPC_MEM_SIZE_) };
+static const int mpc_mem_nums[] = { MPC_MEM_CLASSES(MPC_MEM_NUM_) };
+
+enum {
+  MPC_INPUT_CHUNK = 65536
+};
+
+typedef union {
+  char bytes[0 MPC_MEM_CLASSES(MPC_MEM_BYTES_)];
+  void *align_ptr;
+  long align_long;
+  double align_double;
 } mpc_mem_t;
 
+/*
+** With packrat parsing a memo entry records how a rule
+** went at a position - where it stopped, its result &
+** the furthest error it saw - so it can be replayed
+** rather than reparsed when the input is rewound.
+**
+** Entries are kept in two generations of a hash table.
+** Once the newer generation is full the older one is
+** dropped, so the table stays within MPC_MEMO_BUDGET
+** bytes & holds the window of input most recently
+** parsed, which is where rewinds land.
+*/
+
+#ifndef MPC_MEMO_BUDGET
+#define MPC_MEMO_BUDGET (1 << 22)
+#endif
+
+/*
+** While parsing, errors are not built as `mpc_err_t`
+** but kept as plain records pointing at strings the
+** parsers own. A parser that fails leaves one
+** `mpc_fail_t`, & the furthest of these are gathered
+** into an `mpc_furthest_t`. Only once the whole parse
+** has failed is that copied out as an `mpc_err_t`, so
+** a parse that succeeds allocates nothing for errors.
+*/
+
+enum {
+  MPC_FURTHEST_LOCAL = 8
+};
+
+typedef struct {
+  mpc_state_t state;
+  char recieved;
+  const char *expected;
+  const char *failure;
+} mpc_fail_t;
+
+typedef struct {
+  mpc_state_t state;
+  char recieved;
+  const char *failure;
+  int expected_num;
+  int expected_slots;
+  const char **expected;
+  const char *expected_local[MPC_FURTHEST_LOCAL];
+} mpc_furthest_t;
+
+/* Expected strings stay in `expected_local` until there are too many */
+#define MPC_FURTHEST_EXPECTED(f) ((f)->expected ? (f)->expected : (f)->expected_local)
+
+/* A rule matched while parsing for events */
+typedef struct {
+  mpc_parser_t *rule;
+  long start;
+  long end;
+} mpc_span_t;
+
+/*
+** A token lexed at `offset` is the longest match of
+** any kind, with `kinds` holding every kind matching
+** all of it & `kind` the first. `space` counts the
+** whitespace after it. If `kind` is a regex, `stop` is
+** where its automaton stopped & `expected` what it
+** expected there.
+*/
+typedef struct {
+  long offset;
+  long length;
+  long space;
+  unsigned long kinds;
+  int kind;
+  long stop;
+  const char *expected;
+} mpc_token_t;
+
+typedef struct mpc_lexer_t mpc_lexer_t;
+
+typedef struct mpc_memo_t {
+  mpc_parser_t *p;
+  long pos;
+  int flags;
+  int ok;
+  mpc_state_t end;
+  char last;
+  mpc_val_t *output;
+  mpc_dtor_t d;
+  int status;
+  mpc_fail_t error;
+  mpc_furthest_t furthest;
+  struct mpc_memo_t *next;
+  struct mpc_memo_t *lent_next;
+} mpc_memo_t;
+
 typedef struct {
 
   int type;
@@ -80,9 +221,18 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
-  char *buffer;
+  long length;
+  int owned;
   FILE *file;
   
+  char **chunks;
+  int chunks_num;
+  int chunks_slots;
+  long chunks_pos;
+  long chunks_end;
+  int chunks_eof;
+  char *chunks_spare;
+  
   int suppress;
   int backtrack;
   int marks_slots;
@@ -92,12 +242,68 @@ typedef struct {
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  char **messages;
+  int messages_num;
+  int messages_slots;
+  
+  mpc_arena_t *arena;
+  
+  mpca_event_t event;
+  void *event_data;
+  mpc_span_t *spans;
+  int spans_num;
+  int spans_slots;
+  
+  mpc_profile_t *profile;
+  
+  mpc_lexer_t *lexer;
+  mpc_token_t *tokens;
+  
+  mpc_memo_t **memo_new;
+  mpc_memo_t **memo_old;
+  mpc_memo_t **memo_lent;
+  int memo_slots;
+  int memo_num;
+  int memo_lent_num;
+  unsigned long memo_hits;
+  unsigned long memo_misses;
+  
+  int mem_used[MPC_MEM_CLASS_NUM];
+  void *mem_free[MPC_MEM_CLASS_NUM];
+  unsigned long mem_hits;
+  unsigned long mem_fallbacks;
+  mpc_mem_t mem;
   
 } mpc_input_t;
 
+/*
+** Blocks are handed out in order until a class is
+** used up, after which freed blocks are reused from
+** a list threaded through them. Nothing needs to be
+** cleared per parse but the counts.
+*/
+static void mpc_input_mem_init(mpc_input_t *i) {
+  int c;
+  for (c = 0; c < MPC_MEM_CLASS_NUM; c++) {
+    i->mem_used[c] = 0;
+    i->mem_free[c] = NULL;
+  }
+  i->mem_hits = 0;
+  i->mem_fallbacks = 0;
+}
+
+/* The memo table is only allocated once a memoised parser runs */
+static void mpc_input_memo_init(mpc_input_t *i) {
+  i->memo_new = NULL;
+  i->memo_old = NULL;
+  i->memo_lent = NULL;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo_lent_num = 0;
+  i->memo_hits = 0;
+  i->memo_misses = 0;
+}
+
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -108,9 +314,17 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
+  /* Borrowed - the caller's string outlives the parse */
+  i->string = (char*)string;
+  i->length = strlen(string);
+  i->owned = 0;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->chunks_slots = 0;
+  i->chunks_pos = 0;
+  i->chunks_end = 0;
+  i->chunks_eof = 0;
+  i->chunks_spare = NULL;
   i->file = NULL;
   
   i->suppress = 0;
@@ -121,8 +335,21 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->messages = NULL;
+  i->messages_num = 0;
+  i->messages_slots = 0;
+  i->arena = NULL;
+  i->event = NULL;
+  i->event_data = NULL;
+  i->spans = NULL;
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->profile = NULL;
+  i->lexer = NULL;
+  i->tokens = NULL;
+  
+  mpc_input_mem_init(i);
+  mpc_input_memo_init(i);
   
   return i;
 }
@@ -140,7 +367,15 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
-  i->buffer = NULL;
+  i->length = strlen(i->string);
+  i->owned = 1;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->chunks_slots = 0;
+  i->chunks_pos = 0;
+  i->chunks_end = 0;
+  i->chunks_eof = 0;
+  i->chunks_spare = NULL;
   i->file = NULL;
   
   i->suppress = 0;
@@ -151,8 +386,21 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->messages = NULL;
+  i->messages_num = 0;
+  i->messages_slots = 0;
+  i->arena = NULL;
+  i->event = NULL;
+  i->event_data = NULL;
+  i->spans = NULL;
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->profile = NULL;
+  i->lexer = NULL;
+  i->tokens = NULL;
+  
+  mpc_input_mem_init(i);
+  mpc_input_memo_init(i);
   
   return i;
 
@@ -169,7 +417,15 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
+  i->owned = 0;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->chunks_slots = 0;
+  i->chunks_pos = 0;
+  i->chunks_end = 0;
+  i->chunks_eof = 0;
+  i->chunks_spare = NULL;
   i->file = pipe;
   
   i->suppress = 0;
@@ -180,8 +436,21 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->messages = NULL;
+  i->messages_num = 0;
+  i->messages_slots = 0;
+  i->arena = NULL;
+  i->event = NULL;
+  i->event_data = NULL;
+  i->spans = NULL;
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->profile = NULL;
+  i->lexer = NULL;
+  i->tokens = NULL;
+  
+  mpc_input_mem_init(i);
+  mpc_input_memo_init(i);
   
   return i;
   
@@ -197,7 +466,15 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
+  i->owned = 0;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->chunks_slots = 0;
+  i->chunks_pos = 0;
+  i->chunks_end = 0;
+  i->chunks_eof = 0;
+  i->chunks_spare = NULL;
   i->file = file;
   
   i->suppress = 0;
@@ -208,47 +485,207 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->messages = NULL;
+  i->messages_num = 0;
+  i->messages_slots = 0;
+  i->arena = NULL;
+  i->event = NULL;
+  i->event_data = NULL;
+  i->spans = NULL;
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->profile = NULL;
+  i->lexer = NULL;
+  i->tokens = NULL;
+  
+  mpc_input_mem_init(i);
+  mpc_input_memo_init(i);
+  
+  return i;
+}
+
+#ifdef MPC_HAVE_MMAP
+
+/*
+** Maps a whole file read-only and reads it as a string. The mapping is not
+** NUL-terminated, so reads past the end are checked against the length.
+** Returns NULL if the file cannot be mapped, e.g. it is empty or a pipe.
+*/
+static mpc_input_t *mpc_input_new_mmap(const char *filename, int fd) {
+  
+  mpc_input_t *i;
+  struct stat st;
+  void *map;
+  
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { return NULL; }
+  
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) { return NULL; }
+  
+  /* Parsing mostly moves forward - read ahead aggressively */
+#ifdef MADV_SEQUENTIAL
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  madvise(map, st.st_size, MADV_WILLNEED);
+#endif
+  
+  i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = MPC_INPUT_MMAP;
+  i->state = mpc_state_new();
+  
+  i->string = map;
+  i->length = st.st_size;
+  i->owned = 0;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->chunks_slots = 0;
+  i->chunks_pos = 0;
+  i->chunks_end = 0;
+  i->chunks_eof = 0;
+  i->chunks_spare = NULL;
+  i->file = NULL;
+  
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  
+  i->messages = NULL;
+  i->messages_num = 0;
+  i->messages_slots = 0;
+  i->arena = NULL;
+  i->event = NULL;
+  i->event_data = NULL;
+  i->spans = NULL;
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->profile = NULL;
+  i->lexer = NULL;
+  i->tokens = NULL;
+  
+  mpc_input_mem_init(i);
+  mpc_input_memo_init(i);
   
   return i;
 }
 
+#endif
+
+static unsigned long mpc_mem_hits_total = 0;
+static unsigned long mpc_mem_fallbacks_total = 0;
+static unsigned long mpc_memo_hits_total = 0;
+static unsigned long mpc_memo_misses_total = 0;
+
+void mpc_mem_stats(unsigned long *hits, unsigned long *fallbacks) {
+#ifdef __GNUC__
+  *hits = __atomic_load_n(&mpc_mem_hits_total, __ATOMIC_RELAXED);
+  *fallbacks = __atomic_load_n(&mpc_mem_fallbacks_total, __ATOMIC_RELAXED);
+#else
+  *hits = mpc_mem_hits_total;
+  *fallbacks = mpc_mem_fallbacks_total;
+#endif
+}
+
+void mpc_memo_stats(unsigned long *hits, unsigned long *misses) {
+#ifdef __GNUC__
+  *hits = __atomic_load_n(&mpc_memo_hits_total, __ATOMIC_RELAXED);
+  *misses = __atomic_load_n(&mpc_memo_misses_total, __ATOMIC_RELAXED);
+#else
+  *hits = mpc_memo_hits_total;
+  *misses = mpc_memo_misses_total;
+#endif
+}
+
+static void mpc_input_memo_delete(mpc_input_t *i);
+
 static void mpc_input_delete(mpc_input_t *i) {
   
+  int j;
+  
+#ifdef __GNUC__
+  __atomic_add_fetch(&mpc_mem_hits_total, i->mem_hits, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mpc_mem_fallbacks_total, i->mem_fallbacks, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mpc_memo_hits_total, i->memo_hits, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mpc_memo_misses_total, i->memo_misses, __ATOMIC_RELAXED);
+#else
+  mpc_mem_hits_total += i->mem_hits;
+  mpc_mem_fallbacks_total += i->mem_fallbacks;
+  mpc_memo_hits_total += i->memo_hits;
+  mpc_memo_misses_total += i->memo_misses;
+#endif
+  
+  mpc_input_memo_delete(i);
+  
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  if (i->type == MPC_INPUT_STRING && i->owned) { free(i->string); }
+  if (i->type == MPC_INPUT_PIPE) {
+    for (j = 0; j < i->chunks_num; j++) { free(i->chunks[j]); }
+    free(i->chunks);
+    free(i->chunks_spare);
+  }
+#ifdef MPC_HAVE_MMAP
+  if (i->type == MPC_INPUT_MMAP) { munmap(i->string, i->length); }
+#endif
+  
+  for (j = 0; j < i->messages_num; j++) { free(i->messages[j]); }
+  free(i->messages);
+  free(i->spans);
+  free(i->tokens);
   
   free(i->marks);
   free(i->lasts);
   free(i);
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+static int mpc_mem_class(mpc_input_t *i, void *p) {
+  
+  char *start = i->mem.bytes;
+  int c;
+  
+  if ((char*)p < start || (char*)p >= start + sizeof(mpc_mem_t)) { return -1; }
+  
+  for (c = 0; c < MPC_MEM_CLASS_NUM; c++) {
+    start += mpc_mem_sizes[c] * mpc_mem_nums[c];
+    if ((char*)p < start) { return c; }
+  }
+  
+  return -1;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
   
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  char *start = i->mem.bytes;
+  void *p;
+  int c;
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
+  for (c = 0; c < MPC_MEM_CLASS_NUM; c++) {
+    
+    if (n <= mpc_mem_sizes[c]) {
+      
+      if (i->mem_free[c]) {
+        p = i->mem_free[c];
+        i->mem_free[c] = *(void**)p;
+        i->mem_hits++;
+        return p;
+      }
+      
+      if (i->mem_used[c] < mpc_mem_nums[c]) {
+        p = start + mpc_mem_sizes[c] * i->mem_used[c]++;
+        i->mem_hits++;
+        return p;
+      }
     }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+    
+    start += mpc_mem_sizes[c] * mpc_mem_nums[c];
+  }
   
+  i->mem_fallbacks++;
   return malloc(n);
 }
 
@@ -259,21 +696,22 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  int c = mpc_mem_class(i, p);
+  if (c < 0) { free(p); return; }
+  *(void**)p = i->mem_free[c];
+  i->mem_free[c] = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   
   char *q = NULL;
+  int c = mpc_mem_class(i, p);
   
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (c < 0) { return realloc(p, n); }
   
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
+  if (n > mpc_mem_sizes[c]) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, mpc_mem_sizes[c]);
     mpc_free(i, p);
     return q;
   }
@@ -283,9 +721,10 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  int c = mpc_mem_class(i, p);
+  if (c < 0) { return p; }
+  q = malloc(mpc_mem_sizes[c]);
+  memcpy(q, p, mpc_mem_sizes[c]);
   mpc_free(i, p);
   return q; 
 }
@@ -311,10 +750,6 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-  
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
@@ -332,17 +767,18 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
   }
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-  
 }
 
+static void mpc_profile_rewind(mpc_profile_t *f);
+
 static void mpc_input_rewind(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
+  if (i->profile && i->state.pos != i->marks[i->marks_num-1].pos) {
+    mpc_profile_rewind(i->profile);
+  }
+  
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
   
@@ -353,18 +789,69 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+/*
+** Makes sure the character at the current position
+** of a pipe has been read, returning 0 at the end of
+** input. Chunks no mark can rewind to are recycled
+** before another block is read.
+*/
+static int mpc_input_pipe_fill(mpc_input_t *i) {
+  
+  long keep, used;
+  int drop, j;
+  size_t n;
+  
+  while (i->state.pos >= i->chunks_end) {
+    
+    if (i->chunks_eof) { return 0; }
+    
+    keep = i->marks_num > 0 && i->marks[0].pos < i->state.pos ? i->marks[0].pos : i->state.pos;
+    drop = (int)((keep - i->chunks_pos) / MPC_INPUT_CHUNK);
+    if (drop >= i->chunks_num) { drop = i->chunks_num - 1; }
+    
+    for (j = 0; j < drop; j++) {
+      if (i->chunks_spare) { free(i->chunks[j]); } else { i->chunks_spare = i->chunks[j]; }
+    }
+    if (drop > 0) {
+      memmove(i->chunks, i->chunks + drop, sizeof(char*) * (i->chunks_num - drop));
+      i->chunks_num -= drop;
+      i->chunks_pos += (long)drop * MPC_INPUT_CHUNK;
+    }
+    
+    used = i->chunks_end - i->chunks_pos;
+    if (used == (long)i->chunks_num * MPC_INPUT_CHUNK) {
+      if (i->chunks_num == i->chunks_slots) {
+        i->chunks_slots = i->chunks_slots ? i->chunks_slots * 2 : 4;
+        i->chunks = realloc(i->chunks, sizeof(char*) * i->chunks_slots);
+      }
+      if (i->chunks_spare) {
+        i->chunks[i->chunks_num++] = i->chunks_spare;
+        i->chunks_spare = NULL;
+      } else {
+        i->chunks[i->chunks_num++] = malloc(MPC_INPUT_CHUNK);
+      }
+      used = (long)(i->chunks_num - 1) * MPC_INPUT_CHUNK;
+    }
+    
+    n = fread(i->chunks[i->chunks_num-1] + used % MPC_INPUT_CHUNK, 1,
+      MPC_INPUT_CHUNK - used % MPC_INPUT_CHUNK, i->file);
+    if (n == 0) { i->chunks_eof = 1; }
+    i->chunks_end += n;
+  }
+  
+  return 1;
 }
 
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+static char mpc_input_pipe_get(mpc_input_t *i) {
+  long off = i->state.pos - i->chunks_pos;
+  return i->chunks[off / MPC_INPUT_CHUNK][off % MPC_INPUT_CHUNK];
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_pipe_fill(i)) { return 1; }
   return 0;
 }
 
@@ -375,18 +862,9 @@ static char mpc_input_getc(mpc_input_t *i) {
   switch (i->type) {
     
     case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_MMAP: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-    
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    case MPC_INPUT_PIPE: return mpc_input_pipe_fill(i) ? mpc_input_pipe_get(i) : '\0';
     
     default: return c;
   }
@@ -398,6 +876,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   
   switch (i->type) {
     case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_MMAP: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -406,23 +885,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
       fseek(i->file, -1, SEEK_CUR);
       return c;
     
-    case MPC_INPUT_PIPE:
-      
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+    case MPC_INPUT_PIPE: return mpc_input_pipe_fill(i) ? mpc_input_pipe_get(i) : '\0';
     
     default: return c;
   }
@@ -434,16 +897,6 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-      
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file); 
-      }
-    }
     default: { break; }
   }
   return 0;
@@ -451,13 +904,6 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-  
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -476,6 +922,23 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   return 1;
 }
 
+/*
+** Moves past `n` characters already known to be
+** those at the current position.
+*/
+static void mpc_input_advance(mpc_input_t *i, const char *s, long n) {
+  long k;
+  for (k = 0; k < n; k++) {
+    i->state.pos++;
+    i->state.col++;
+    if (s[k] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  if (n > 0) { i->last = s[n-1]; }
+}
+
 static int mpc_input_any(mpc_input_t *i, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
@@ -575,14 +1038,13 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+/* Quoted characters are written to `buffer`, which must hold four */
+static const char *mpc_err_char_unescape(char c, char *buffer) {
   
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buffer[0] = '\'';
+  buffer[1] = ' ';
+  buffer[2] = '\'';
+  buffer[3] = '\0';
   
   switch (c) {
     case '\a': return "bell";
@@ -595,8 +1057,8 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buffer[1] = c;
+      return buffer;
   }
   
 }
@@ -607,6 +1069,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int pos = 0; 
   int max = 1023;
   char *buffer = calloc(1, 1024);
+  char recieved[4];
   
   if (x->failure) {
     mpc_err_string_cat(buffer, &pos, &max,
@@ -631,43 +1094,12 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->recieved, recieved));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
   return realloc(buffer, strlen(buffer) + 1);
 }
 
-static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
-  mpc_err_t *x;
-  if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
-  x->expected_num = 1;
-  x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
-  x->failure = NULL;
-  x->recieved = mpc_input_peekc(i);
-  return x;
-}
-
-static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
-  mpc_err_t *x;
-  if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
-  x->expected_num = 0;
-  x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
-  strcpy(x->failure, failure);
-  x->recieved = ' ';
-  return x;
-}
-
 static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   mpc_err_t *x;
   x = malloc(sizeof(mpc_err_t));
@@ -682,180 +1114,198 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   return x;
 }
 
-static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
-  int j;
-  if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-  mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
-  mpc_free(i, x);
+static void mpc_fail_none(mpc_fail_t *x) {
+  x->expected = NULL;
+  x->failure = NULL;
 }
 
-static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
-  int j;
-  for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
-  }
-  x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
-  x->failure = mpc_export(i, x->failure);
-  return mpc_export(i, x);
+static void mpc_fail_expected(mpc_input_t *i, mpc_fail_t *x, const char *expected) {
+  mpc_fail_none(x);
+  if (i->suppress) { return; }
+  x->state = i->state;
+  x->recieved = mpc_input_peekc(i);
+  x->expected = expected;
+}
+
+static void mpc_fail_failure(mpc_input_t *i, mpc_fail_t *x, const char *failure) {
+  mpc_fail_none(x);
+  if (i->suppress) { return; }
+  x->state = i->state;
+  x->recieved = ' ';
+  x->failure = failure;
 }
 
-static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
+/*
+** Repeats reword what they expected, such as "one or
+** more of digit". The new strings are kept with the
+** input & reused, so failing again allocates nothing.
+*/
+static const char *mpc_input_message(mpc_input_t *i, const char *prefix, const char *expected) {
+
   int j;
-  (void)i;
-  for (j = 0; j < x->expected_num; j++) {
-    if (strcmp(x->expected[j], expected) == 0) { return 1; }
+  size_t n = strlen(prefix);
+  char *m;
+
+  for (j = 0; j < i->messages_num; j++) {
+    m = i->messages[j];
+    if (strncmp(m, prefix, n) == 0 && strcmp(m + n, expected) == 0) { return m; }
   }
-  return 0;
+
+  if (i->messages_num == i->messages_slots) {
+    i->messages_slots = i->messages_slots ? i->messages_slots * 2 : 8;
+    i->messages = realloc(i->messages, sizeof(char*) * i->messages_slots);
+  }
+
+  m = malloc(n + strlen(expected) + 1);
+  strcpy(m, prefix);
+  strcat(m, expected);
+  i->messages[i->messages_num++] = m;
+  return m;
 }
 
-static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  (void)i;
-  x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[x->expected_num-1], expected);
+/* A failure is never reworded - only its message is ever shown */
+static void mpc_fail_many1(mpc_input_t *i, mpc_fail_t *x) {
+  if (x->expected == NULL) { return; }
+  x->expected = mpc_input_message(i, "one or more of ", x->expected);
 }
 
-static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
-  
-  int j, k, fst;
-  mpc_err_t *e;
-  
-  fst = -1;
-  for (j = 0; j < n; j++) {
-    if (x[j] != NULL) { fst = j; }
-  }
-  
-  if (fst == -1) { return NULL; }
-  
-  e = mpc_malloc(i, sizeof(mpc_err_t));
-  e->state = mpc_state_invalid();
-  e->expected_num = 0;
-  e->expected = NULL;
-  e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename)+1);
-  strcpy(e->filename, x[fst]->filename);
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos > e->state.pos) { e->state = x[j]->state; }
-  }
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos < e->state.pos) { continue; }
-    
-    if (x[j]->failure) {
-      e->failure = mpc_malloc(i, strlen(x[j]->failure)+1);
-      strcpy(e->failure, x[j]->failure);
-      break;
-    }
-    
-    e->recieved = x[j]->recieved;
-    
-    for (k = 0; k < x[j]->expected_num; k++) {
-      if (!mpc_err_contains_expected(i, e, x[j]->expected[k])) {
-        mpc_err_add_expected(i, e, x[j]->expected[k]);
-      }
-    }
-  }
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    mpc_err_delete_internal(i, x[j]);
-  }
-  
-  return e;
+static void mpc_fail_count(mpc_input_t *i, mpc_fail_t *x, int n) {
+  char prefix[32];
+  if (x->expected == NULL) { return; }
+  sprintf(prefix, "%i of ", n);
+  x->expected = mpc_input_message(i, prefix, x->expected);
 }
 
-static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefix) {
+static void mpc_furthest_init(mpc_furthest_t *f) {
+  f->state = mpc_state_invalid();
+  f->recieved = ' ';
+  f->failure = NULL;
+  f->expected_num = 0;
+  f->expected_slots = 0;
+  f->expected = NULL;
+}
 
-  int j = 0;
-  size_t l = 0;
-  char *expect = NULL;
-  
-  if (x == NULL) { return NULL; }
-  
-  if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
-    return x;
-  }
-  
-  else if (x->expected_num == 1) {
-    expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
-    strcpy(expect, prefix);
-    strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
-    x->expected[0] = expect;
-    return x;
+static void mpc_furthest_delete(mpc_furthest_t *f) {
+  free(f->expected);
+}
+
+static void mpc_furthest_add(mpc_furthest_t *f, const char *expected) {
+
+  int j;
+  const char **xs = MPC_FURTHEST_EXPECTED(f);
+
+  for (j = 0; j < f->expected_num; j++) {
+    if (xs[j] == expected || strcmp(xs[j], expected) == 0) { return; }
   }
-  
-  else if (x->expected_num > 1) {
-    
-    l += strlen(prefix);
-    for (j = 0; j < x->expected_num-2; j++) {
-      l += strlen(x->expected[j]) + strlen(", ");
-    }
-    l += strlen(x->expected[x->expected_num-2]);
-    l += strlen(" or ");
-    l += strlen(x->expected[x->expected_num-1]);
-    
-    expect = mpc_malloc(i, l + 1);
-    
-    strcpy(expect, prefix);
-    for (j = 0; j < x->expected_num-2; j++) {
-      strcat(expect, x->expected[j]); strcat(expect, ", ");
-    }
-    strcat(expect, x->expected[x->expected_num-2]);
-    strcat(expect, " or ");
-    strcat(expect, x->expected[x->expected_num-1]);
 
-    for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-    
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
-    return x;
+  if (f->expected == NULL && f->expected_num == MPC_FURTHEST_LOCAL) {
+    f->expected_slots = MPC_FURTHEST_LOCAL * 2;
+    f->expected = malloc(sizeof(char*) * f->expected_slots);
+    memcpy(f->expected, f->expected_local, sizeof(char*) * MPC_FURTHEST_LOCAL);
+  } else if (f->expected && f->expected_num == f->expected_slots) {
+    f->expected_slots *= 2;
+    f->expected = realloc(f->expected, sizeof(char*) * f->expected_slots);
   }
-  
-  return NULL;
+
+  MPC_FURTHEST_EXPECTED(f)[f->expected_num++] = expected;
 }
 
-static mpc_err_t *mpc_err_many1(mpc_input_t *i, mpc_err_t *x) {
-  return mpc_err_repeat(i, x, "one or more of ");
+/*
+** Merging keeps what was seen at the furthest position,
+** in the order it was first seen. Once a failure is
+** recorded there, nothing else at that position is.
+** Returns if what is at `state` should be added.
+*/
+static int mpc_furthest_reach(mpc_furthest_t *f, mpc_state_t *state) {
+  if (state->pos < f->state.pos) { return 0; }
+  if (state->pos > f->state.pos) {
+    f->state = *state;
+    f->failure = NULL;
+    f->expected_num = 0;
+  }
+  return f->failure == NULL;
 }
 
-static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
-  mpc_err_t *y;
-  int digits = n/10 + 1;
-  char *prefix;
-  prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
-  sprintf(prefix, "%i of ", n);
-  y = mpc_err_repeat(i, x, prefix);
-  mpc_free(i, prefix);
-  return y;
+static void mpc_furthest_merge(mpc_furthest_t *f, mpc_fail_t *x) {
+  if (x->expected == NULL && x->failure == NULL) { return; }
+  if (!mpc_furthest_reach(f, &x->state)) { return; }
+  if (x->failure) { f->failure = x->failure; return; }
+  f->recieved = x->recieved;
+  mpc_furthest_add(f, x->expected);
 }
 
-static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
-  mpc_err_t *errs[2];
-  errs[0] = x;
-  errs[1] = y;
-  return mpc_err_or(i, errs, 2);
+static void mpc_furthest_merge_all(mpc_furthest_t *f, mpc_furthest_t *g) {
+
+  int j;
+  const char **xs = MPC_FURTHEST_EXPECTED(g);
+
+  if (g->failure == NULL && g->expected_num == 0) { return; }
+  if (!mpc_furthest_reach(f, &g->state)) { return; }
+  if (g->failure) { f->failure = g->failure; return; }
+
+  f->recieved = g->recieved;
+  for (j = 0; j < g->expected_num; j++) { mpc_furthest_add(f, xs[j]); }
 }
 
 /*
-** Parser Type
+** Same as merging in a failure expecting each of
+** `expected` at the current position.
 */
+static void mpc_furthest_merge_expected(mpc_input_t *i, mpc_furthest_t *f, char **expected, int n) {
+  int j;
+  if (n == 0 || i->suppress) { return; }
+  if (!mpc_furthest_reach(f, &i->state)) { return; }
+  for (j = 0; j < n; j++) { mpc_furthest_add(f, expected[j]); }
+  f->recieved = mpc_input_peekc(i);
+}
+
+/* `f` must be unused - memo entries take a copy sized to fit */
+static void mpc_furthest_copy(mpc_furthest_t *f, mpc_furthest_t *g) {
+  mpc_furthest_init(f);
+  f->state = g->state;
+  f->recieved = g->recieved;
+  f->failure = g->failure;
+  f->expected_num = g->expected_num;
+  if (g->expected_num > MPC_FURTHEST_LOCAL) {
+    f->expected_slots = g->expected_num;
+    f->expected = malloc(sizeof(char*) * g->expected_num);
+  }
+  memcpy(MPC_FURTHEST_EXPECTED(f), MPC_FURTHEST_EXPECTED(g), sizeof(char*) * g->expected_num);
+}
 
-enum {
-  MPC_TYPE_UNDEFINED = 0,
+static char *mpc_err_strdup(const char *x) {
+  char *y = malloc(strlen(x) + 1);
+  strcpy(y, x);
+  return y;
+}
+
+static mpc_err_t *mpc_furthest_err(mpc_input_t *i, mpc_furthest_t *f) {
+
+  int j;
+  const char **xs = MPC_FURTHEST_EXPECTED(f);
+  mpc_err_t *x = malloc(sizeof(mpc_err_t));
+
+  x->filename = mpc_err_strdup(i->filename);
+  x->state = f->state;
+  x->recieved = f->recieved;
+  x->failure = f->failure ? mpc_err_strdup(f->failure) : NULL;
+  x->expected_num = f->expected_num;
+  x->expected = NULL;
+
+  if (f->expected_num) {
+    x->expected = malloc(sizeof(char*) * f->expected_num);
+    for (j = 0; j < f->expected_num; j++) { x->expected[j] = mpc_err_strdup(xs[j]); }
+  }
+
+  return x;
+}
+
+/*
+** Parser Type
+*/
+
+enum {
+  MPC_TYPE_UNDEFINED = 0,
   MPC_TYPE_PASS      = 1,
   MPC_TYPE_FAIL      = 2,
   MPC_TYPE_LIFT      = 3,
@@ -882,7 +1332,86 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_DFA       = 25,
+  MPC_TYPE_MEMO      = 26,
+  MPC_TYPE_TOKEN     = 27
+};
+
+/*
+** A regex compiled to a deterministic automaton. The
+** start state is 0 & `trans` maps each state & input
+** byte to the next state, or -1 where no match can be
+** extended. `expected` describes which bytes each
+** state can continue with, for error messages.
+*/
+typedef struct {
+  int states;
+  int *trans;
+  char *accept;
+  char **expected;
+  char *re;
+} mpc_dfa_t;
+
+/*
+** A trie over the literal strings of an `or`. Node 0
+** is the root & the edges of node `k` are `keys` &
+** `kids` from `edges[k]` up to `edges[k+1]`, sorted by
+** key. `alt` is the first alternative whose literal
+** ends at a node, or the number of alternatives.
+*/
+typedef struct {
+  int num;
+  int *alt;
+  int *edges;
+  unsigned char *keys;
+  int *kids;
+} mpc_trie_t;
+
+/*
+** An `or` compiled by `mpc_optimise` into a table on
+** the next byte: `skip` holds, for each alternative,
+** the bytes it cannot start with. A skipped alternative
+** would have failed without consuming anything, so the
+** strings it would have reported are kept in
+** `expected` & merged into the error instead.
+**
+** Alternatives that match exactly a literal string are
+** marked in `literal` & also go in `trie`, so one pass
+** over the input finds which of them matches. `others`
+** lists the remaining alternatives in order.
+*/
+typedef struct {
+  unsigned char (*skip)[32];
+  int *expected_num;
+  char ***expected;
+  char *literal;
+  int *others;
+  int others_num;
+  mpc_trie_t *trie;
+} mpc_dispatch_t;
+
+/*
+** The literals & regexes of a grammar built with
+** `MPCA_LANG_TOKENIZE`, one for each kind of token.
+** `cands` lists the kinds that can start with byte `c`
+** from `starts[c]` up to `starts[c+1]`, & is built
+** once the grammar defining the kinds is complete, so
+** parses only ever read the lexer.
+*/
+typedef struct {
+  char *lit;
+  long len;
+  mpc_dfa_t *dfa;
+} mpc_lex_kind_t;
+
+struct mpc_lexer_t {
+  int num;
+  mpc_lex_kind_t *kinds;
+  int *cands;
+  int starts[257];
+  int refs;
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -898,8 +1427,11 @@ typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_t
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_dispatch_t *d; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_dfa_t *x; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_dtor_t d; mpc_parser_t *k; } mpc_pdata_memo_t;
+typedef struct { mpc_parser_t *x; mpc_lexer_t *l; int kind; } mpc_pdata_token_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -917,15 +1449,404 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_token_t token;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
   char retained;
+  char arena;
   char *name;
+  unsigned long rule;
   char type;
   mpc_pdata_t data;
 };
 
+/* Tags a tree with the rule `p` it matched, both by name & by bit */
+static mpc_val_t *mpcaf_ast_add_rule(mpc_val_t *x, void *p) {
+  mpc_ast_t *a = mpc_ast_add_tag(x, ((mpc_parser_t*)p)->name);
+  if (a) { a->rules |= ((mpc_parser_t*)p)->rule; }
+  return a;
+}
+
+/*
+** AST Arena
+**
+** A grammar built with `MPCA_LANG_ARENA` builds its
+** trees in an arena owned by the result. Each node is
+** allocated in one piece along with its children, tag
+** & contents, nothing is freed while parsing, & the
+** whole tree goes in a single `mpc_arena_delete`.
+**
+** Trees are only built here when the parse starts
+** from one of the grammar's rules. They must not be
+** changed with the `mpc_ast_*` functions afterwards.
+*/
+
+#ifndef MPC_ARENA_BLOCK
+#define MPC_ARENA_BLOCK 65536
+#endif
+
+typedef union {
+  void *align_ptr;
+  long align_long;
+  double align_double;
+} mpc_arena_align_t;
+
+/* Each block begins with a pointer to the one before */
+struct mpc_arena_t {
+  char *block;
+  size_t used;
+  size_t size;
+};
+
+static mpc_arena_t *mpc_arena_new(void) {
+  mpc_arena_t *a = malloc(sizeof(mpc_arena_t));
+  a->block = NULL;
+  a->used = 0;
+  a->size = 0;
+  return a;
+}
+
+void mpc_arena_delete(mpc_arena_t *a) {
+  char *b, *prev;
+  if (a == NULL) { return; }
+  for (b = a->block; b; b = prev) {
+    prev = *(char**)b;
+    free(b);
+  }
+  free(a);
+}
+
+static void *mpc_arena_alloc(mpc_arena_t *a, size_t n) {
+
+  size_t head = sizeof(mpc_arena_align_t);
+  size_t size = a->size ? a->size : MPC_ARENA_BLOCK;
+  char *b;
+
+  n = (n + head - 1) / head * head;
+
+  if (a->used + n > a->size) {
+    while (head + n > size) { size *= 2; }
+    b = malloc(size);
+    *(char**)b = a->block;
+    a->block = b;
+    a->used = head;
+    a->size = size;
+  }
+
+  a->used += n;
+  return a->block + a->used - n;
+}
+
+static mpc_ast_t *mpc_arena_ast(mpc_arena_t *a, const char *tag, const char *contents, int children_num) {
+
+  size_t t = strlen(tag) + 1;
+  size_t c = strlen(contents) + 1;
+  size_t k = sizeof(mpc_ast_t*) * children_num;
+  mpc_ast_t *x = mpc_arena_alloc(a, sizeof(mpc_ast_t) + k + t + c);
+
+  x->children = children_num ? (mpc_ast_t**)(x + 1) : NULL;
+  x->children_num = children_num;
+  x->tag = (char*)(x + 1) + k;
+  x->contents = x->tag + t;
+  x->rules = 0;
+  memcpy(x->tag, tag, t);
+  memcpy(x->contents, contents, c);
+  x->state = mpc_state_new();
+  return x;
+}
+
+static mpc_ast_t *mpc_arena_tag(mpc_arena_t *a, mpc_ast_t *x, const char *t) {
+  size_t n = strlen(t) + 1;
+  x->tag = mpc_arena_alloc(a, n);
+  memcpy(x->tag, t, n);
+  return x;
+}
+
+/* Prefixes the tag with the first `n` characters of `t`, then `sep` */
+static mpc_ast_t *mpc_arena_prefix_tag(mpc_arena_t *a, mpc_ast_t *x, const char *t, size_t n, const char *sep) {
+
+  size_t s, l;
+  char *tag;
+
+  if (x == NULL) { return x; }
+
+  s = strlen(sep);
+  l = strlen(x->tag) + 1;
+  tag = mpc_arena_alloc(a, n + s + l);
+  memcpy(tag, t, n);
+  memcpy(tag + n, sep, s);
+  memcpy(tag + n + s, x->tag, l);
+  x->tag = tag;
+  return x;
+}
+
+static mpc_val_t *mpc_arena_add_root(mpc_arena_t *a, mpc_ast_t *x) {
+  mpc_ast_t *r;
+  if (x == NULL || x->children_num <= 1) { return x; }
+  r = mpc_arena_ast(a, ">", "", 1);
+  r->children[0] = x;
+  return r;
+}
+
+/* As `mpcf_fold_ast`, but counts the children first so they go inline */
+static mpc_val_t *mpcf_arena_fold_ast(mpc_arena_t *a, int n, mpc_val_t **xs) {
+
+  int i, j, num = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r, *c;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  for (i = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    num += as[i]->children_num >= 2 ? as[i]->children_num : 1;
+  }
+
+  r = mpc_arena_ast(a, ">", "", num);
+  num = 0;
+
+  for (i = 0; i < n; i++) {
+
+    if (as[i] == NULL) { continue; }
+
+    if (as[i]->children_num == 0) {
+      r->children[num++] = as[i];
+    } else if (as[i]->children_num == 1) {
+      c = as[i]->children[0];
+      c->rules |= as[i]->rules;
+      r->children[num++] = mpc_arena_prefix_tag(a, c, as[i]->tag, strlen(as[i]->tag) - 1, "");
+    } else {
+      for (j = 0; j < as[i]->children_num; j++) {
+        r->children[num++] = as[i]->children[j];
+      }
+    }
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
+/*
+** Rule Events
+**
+** Parsing for events builds no trees. A rule referred
+** to by name is tagged with just the name, & once the
+** start is known its span is logged. Everything else
+** a grammar builds is NULL. A failed `and`, `count`
+** or `not` drops what was logged since it began, so
+** the log only ever holds the matches that were kept.
+** Spans are sent on as soon as nothing that could
+** drop them would let the parse carry on.
+*/
+
+static void mpc_input_span(mpc_input_t *i, mpc_parser_t *rule, long start) {
+
+  mpc_span_t *s;
+
+  if (i->spans_num == i->spans_slots) {
+    i->spans_slots = i->spans_slots ? i->spans_slots * 2 : 64;
+    i->spans = realloc(i->spans, sizeof(mpc_span_t) * i->spans_slots);
+  }
+
+  s = &i->spans[i->spans_num++];
+  s->rule = rule;
+  s->start = start;
+  s->end = i->state.pos;
+}
+
+static void mpc_input_send_spans(mpc_input_t *i, int n) {
+  int j;
+  mpc_span_t *x;
+  for (j = 0; j < n; j++) {
+    x = &i->spans[j];
+    i->event(x->rule->name, x->rule->rule, x->start, x->end, i->string + x->start, i->event_data);
+  }
+  memmove(i->spans, i->spans + n, sizeof(mpc_span_t) * (i->spans_num - n));
+  i->spans_num -= n;
+}
+
+/* Arena trees are never freed a node at a time, & events build none */
+static int mpc_input_ast_dtor(mpc_input_t *i, mpc_dtor_t d) {
+  return (i->arena || i->event) && d == (mpc_dtor_t)mpc_ast_delete;
+}
+
+/*
+** Packrat Memoisation
+**
+** Results are handed out rather than copied, which
+** keeps a replay constant time. While one is in use
+** the entry holding it is listed as lent, keyed by the
+** result's address. A lent result that is destroyed
+** by a failing parser goes back to its entry instead,
+** ready for the next replay. One that is passed to a
+** fold or apply function may be changed, so its entry
+** gives it up & a later replay has to parse again.
+*/
+
+enum {
+  MPC_MEMO_HELD = 0,
+  MPC_MEMO_LENT = 1,
+  MPC_MEMO_GONE = 2
+};
+
+static int mpc_memo_hash(mpc_input_t *i, const void *p, long pos) {
+  size_t h = ((size_t)p >> 4) ^ ((size_t)pos * 2654435761u);
+  return (int)(h & (size_t)(i->memo_slots - 1));
+}
+
+static void mpc_memo_lend(mpc_input_t *i, mpc_memo_t *m) {
+  int h;
+  if (m->output == NULL) { return; }
+  h = mpc_memo_hash(i, m->output, 0);
+  m->status = MPC_MEMO_LENT;
+  m->lent_next = i->memo_lent[h];
+  i->memo_lent[h] = m;
+  i->memo_lent_num++;
+}
+
+static mpc_memo_t *mpc_memo_unlend(mpc_input_t *i, mpc_val_t *x) {
+  
+  mpc_memo_t *m, **prev;
+  
+  if (i->memo_lent_num == 0 || x == NULL) { return NULL; }
+  
+  for (prev = &i->memo_lent[mpc_memo_hash(i, x, 0)]; *prev; prev = &(*prev)->lent_next) {
+    m = *prev;
+    if (m->output == x) {
+      *prev = m->lent_next;
+      i->memo_lent_num--;
+      return m;
+    }
+  }
+  
+  return NULL;
+}
+
+static void mpc_memo_consume(mpc_input_t *i, mpc_val_t *x) {
+  mpc_memo_t *m = mpc_memo_unlend(i, x);
+  if (m) { m->status = MPC_MEMO_GONE; }
+}
+
+/* At the end of a parse every result still lent belongs to the caller */
+static void mpc_memo_release(mpc_input_t *i) {
+  int j;
+  if (i->memo_lent_num == 0) { return; }
+  for (j = 0; j < i->memo_slots; j++) {
+    while (i->memo_lent[j]) {
+      i->memo_lent[j]->status = MPC_MEMO_GONE;
+      i->memo_lent[j] = i->memo_lent[j]->lent_next;
+    }
+  }
+  i->memo_lent_num = 0;
+}
+
+static void mpc_memo_clear(mpc_input_t *i, mpc_memo_t **table) {
+  
+  mpc_memo_t *m, *next;
+  int j;
+  
+  for (j = 0; j < i->memo_slots; j++) {
+    for (m = table[j]; m; m = next) {
+      next = m->next;
+      if (m->status == MPC_MEMO_LENT) { mpc_memo_unlend(i, m->output); }
+      if (m->status == MPC_MEMO_HELD && m->output && !mpc_input_ast_dtor(i, m->d)) { m->d(m->output); }
+      mpc_furthest_delete(&m->furthest);
+      free(m);
+    }
+    table[j] = NULL;
+  }
+  
+}
+
+static void mpc_input_memo_delete(mpc_input_t *i) {
+  if (i->memo_new == NULL) { return; }
+  mpc_memo_clear(i, i->memo_new);
+  mpc_memo_clear(i, i->memo_old);
+  free(i->memo_new);
+  free(i->memo_old);
+  free(i->memo_lent);
+}
+
+static void mpc_memo_insert(mpc_input_t *i, mpc_memo_t *m) {
+  
+  mpc_memo_t **t;
+  int h;
+  
+  /* Each generation holds at most one entry per slot */
+  if (i->memo_new == NULL) {
+    i->memo_slots = 1;
+    while ((size_t)i->memo_slots * 4 * (sizeof(mpc_memo_t) + sizeof(mpc_memo_t*) * 3 / 2)
+      <= MPC_MEMO_BUDGET) { i->memo_slots *= 2; }
+    i->memo_new = calloc(i->memo_slots, sizeof(mpc_memo_t*));
+    i->memo_old = calloc(i->memo_slots, sizeof(mpc_memo_t*));
+    i->memo_lent = calloc(i->memo_slots, sizeof(mpc_memo_t*));
+  }
+  
+  if (i->memo_num == i->memo_slots) {
+    mpc_memo_clear(i, i->memo_old);
+    t = i->memo_old;
+    i->memo_old = i->memo_new;
+    i->memo_new = t;
+    i->memo_num = 0;
+  }
+  
+  h = mpc_memo_hash(i, m->p, m->pos);
+  m->next = i->memo_new[h];
+  i->memo_new[h] = m;
+  i->memo_num++;
+  
+}
+
+/* Only entries in the newer generation are removed - `mpc_memo_find` puts them there */
+static void mpc_memo_remove(mpc_input_t *i, mpc_memo_t *m) {
+  
+  mpc_memo_t **prev = &i->memo_new[mpc_memo_hash(i, m->p, m->pos)];
+  
+  while (*prev != m) { prev = &(*prev)->next; }
+  *prev = m->next;
+  i->memo_num--;
+  
+  if (m->status == MPC_MEMO_LENT) { mpc_memo_unlend(i, m->output); }
+  mpc_furthest_delete(&m->furthest);
+  free(m);
+  
+}
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, int flags) {
+  
+  mpc_memo_t *m, **prev;
+  int h;
+  
+  if (i->memo_new == NULL) { return NULL; }
+  
+  h = mpc_memo_hash(i, p, i->state.pos);
+  
+  for (m = i->memo_new[h]; m; m = m->next) {
+    if (m->p == p && m->pos == i->state.pos && m->flags == flags) { return m; }
+  }
+  
+  /* Entries still being used move up a generation */
+  for (prev = &i->memo_old[h]; *prev; prev = &(*prev)->next) {
+    m = *prev;
+    if (m->p == p && m->pos == i->state.pos && m->flags == flags) {
+      *prev = m->next;
+      mpc_memo_insert(i, m);
+      return m;
+    }
+  }
+  
+  return NULL;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -949,7 +1870,12 @@ static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
-  a = mpc_ast_state(a, *s);
+  if (i->event) {
+    if (xs[1]) { mpc_input_span(i, xs[1], s->pos); }
+    a = NULL;
+  } else {
+    a = mpc_ast_state(a, *s);
+  }
   mpc_free(i, s);
   (void) n;
   return a;
@@ -957,6 +1883,9 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
 
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
+  if (i->memo_lent_num) {
+    for (j = 0; j < n; j++) { mpc_memo_consume(i, xs[j]); }
+  }
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
   if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
   if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
@@ -966,6 +1895,8 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->event) { return NULL; }
+  if (f == mpcf_fold_ast && i->arena) { return mpcf_arena_fold_ast(i->arena, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -976,273 +1907,1257 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = NULL;
+  if (!i->event) { a = i->arena ? mpc_arena_ast(i->arena, "", c, 0) : mpc_ast_new("", c); }
   mpc_free(i, c);
   return a;
 }
 
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
+  mpc_memo_consume(i, x);
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (i->event && f == (mpc_apply_t)mpc_ast_add_root) { return x; }
+  if (i->arena && f == (mpc_apply_t)mpc_ast_add_root) { return mpc_arena_add_root(i->arena, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  mpc_memo_consume(i, x);
+  if (i->event && f == (mpc_apply_to_t)mpc_ast_tag) { return x; }
+  if (i->event && f == (mpc_apply_to_t)mpc_ast_add_tag) { return d; }
+  if (i->event && f == mpcaf_ast_add_rule) { return d; }
+  if (i->arena && f == (mpc_apply_to_t)mpc_ast_tag) { return mpc_arena_tag(i->arena, x, d); }
+  if (i->arena && f == (mpc_apply_to_t)mpc_ast_add_tag) { return mpc_arena_prefix_tag(i->arena, x, d, strlen(d), "|"); }
+  if (i->arena && f == mpcaf_ast_add_rule) {
+    x = mpc_arena_prefix_tag(i->arena, x, ((mpc_parser_t*)d)->name, strlen(((mpc_parser_t*)d)->name), "|");
+    if (x) { ((mpc_ast_t*)x)->rules |= ((mpc_parser_t*)d)->rule; }
+    return x;
+  }
   return f(mpc_export(i, x), d);
 }
 
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
+  mpc_memo_t *m = mpc_memo_unlend(i, x);
+  if (m) { m->status = MPC_MEMO_HELD; return; }
   if (d == free) { mpc_free(i, x); return; }
+  if (mpc_input_ast_dtor(i, d)) { return; }
   d(mpc_export(i, x));
 }
 
-enum {
-  MPC_PARSE_STACK_MIN = 4
-};
-
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
-
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+/*
+** Runs a DFA from the current position & consumes
+** the longest match. Input held in memory is scanned
+** in place; other input is read a character at a
+** time & rewound to the end of the match.
+**
+** Without backtracking nothing is rewound: as with
+** the combinators, every character the DFA got past
+** stays consumed, whether or not the match fails.
+**
+** Like the combinators it replaces, a match that
+** stopped short of a longer attempt still reports
+** what that attempt expected, so error messages
+** point at the furthest character looked at.
+*/
+static int mpc_parse_dfa(mpc_input_t *i, mpc_dfa_t *d, mpc_result_t *r,
+  mpc_fail_t *fail, mpc_furthest_t *e) {
   
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  mpc_state_t start = i->state;
+  char last = i->last;
+  mpc_fail_t err;
+  const unsigned char *u;
+  char *s;
+  char c;
+  long n = 0, acc = d->accept[0] ? 0 : -1, len, slots, k;
+  int state = 0, next;
   
-  switch (p->type) {
-      
-    /* Basic Parsers */
-
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    
-    /* Other parsers */
-    
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
-    
-    /* Application Parsers */
-    
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
-    
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
-    
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
-    
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {      
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
-    
-    /* Optional Parsers */
-    
-    /* TODO: Update Not Error Message */
-    
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+  mpc_fail_none(&err);
+  
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
     
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+    u = (const unsigned char*)i->string + i->state.pos;
+    len = i->length - i->state.pos;
+    for (n = 0; n < len; n++) {
+      next = d->trans[state * 256 + u[n]];
+      if (next < 0) { break; }
+      state = next;
+      if (d->accept[state]) { acc = n + 1; }
+    }
     
-    /* Repeat Parsers */
+    /* An error no further than one already known is merged away anyway */
+    if (d->expected[state] && (acc < 0 || e->state.pos <= start.pos + n)) {
+      mpc_input_advance(i, (const char*)u, n);
+      mpc_fail_expected(i, &err, d->expected[state]);
+      i->state = start;
+      i->last = last;
+    }
     
-    case MPC_TYPE_MANY:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+    if (acc < 0) {
+      if (i->backtrack < 1) { mpc_input_advance(i, (const char*)u, n); }
+      *fail = err;
+      return 0;
+    }
+    mpc_furthest_merge(e, &err);
     
-    case MPC_TYPE_MANY1:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+    r->output = mpc_malloc(i, acc + 1);
+    memcpy(r->output, u, acc);
+    ((char*)r->output)[acc] = '\0';
+    mpc_input_advance(i, (const char*)u, i->backtrack < 1 ? n : acc);
+    return 1;
+  }
+  
+  slots = 16;
+  s = mpc_malloc(i, slots);
+  
+  mpc_input_mark(i);
+  while (1) {
+    c = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    next = d->trans[state * 256 + (unsigned char)c];
+    if (next < 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    if (n + 1 == slots) {
+      slots *= 2;
+      s = mpc_realloc(i, s, slots);
+    }
+    s[n++] = c;
+    state = next;
+    if (d->accept[state]) { acc = n; }
+  }
+  
+  if (d->expected[state] && (acc < 0 || e->state.pos <= i->state.pos)) {
+    mpc_fail_expected(i, &err, d->expected[state]);
+  }
+  
+  if (acc < 0) {
+    mpc_input_rewind(i);
+    mpc_free(i, s);
+    *fail = err;
+    return 0;
+  }
+  
+  if (acc == n || i->backtrack < 1) {
+    mpc_input_unmark(i);
+  } else {
+    mpc_input_rewind(i);
+    for (k = 0; k < acc; k++) {
+      c = mpc_input_getc(i);
+      mpc_input_success(i, c, NULL);
+    }
+  }
+  
+  mpc_furthest_merge(e, &err);
+  s[acc] = '\0';
+  r->output = s;
+  return 1;
+}
+
+/*
+** A rule can behave differently when errors are
+** suppressed or backtracking is off, so those are
+** part of the key along with the rule & position.
+**
+** The rule runs with an error of its own, which is
+** kept & merged into the caller's. Merging keeps the
+** furthest position & the order expected strings were
+** first seen in, so a replay reports the same error
+** as parsing again would.
+*/
+static int mpc_memo_flags(mpc_input_t *i) {
+  return (i->suppress > 0) | ((i->backtrack < 1) << 1);
+}
+
+static int mpc_memo_replay(mpc_input_t *i, mpc_memo_t *m, mpc_result_t *r,
+  mpc_fail_t *fail, mpc_furthest_t *e) {
+
+  i->memo_hits++;
+  i->state = m->end;
+  i->last = m->last;
+  if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+  mpc_furthest_merge_all(e, &m->furthest);
+
+  if (m->ok) {
+    r->output = m->output;
+    mpc_memo_lend(i, m);
+    return 1;
+  }
+
+  *fail = m->error;
+  return 0;
+}
+
+/*
+** The entry is only added once the rule is done, as
+** the entries added meanwhile may drop generations.
+*/
+static void mpc_memo_record(mpc_input_t *i, mpc_parser_t *p, long pos, int flags,
+  int ok, mpc_result_t *r, mpc_fail_t *fail, mpc_furthest_t *f, mpc_furthest_t *e) {
+
+  mpc_memo_t *m = malloc(sizeof(mpc_memo_t));
+  m->p = p->data.memo.k ? p->data.memo.k : p;
+  m->pos = pos;
+  m->flags = flags;
+  m->ok = ok;
+  m->end = i->state;
+  m->last = i->last;
+  m->output = NULL;
+  m->d = p->data.memo.d;
+  m->status = MPC_MEMO_HELD;
+  mpc_fail_none(&m->error);
+
+  if (ok) {
+    r->output = mpc_export(i, r->output);
+    mpc_memo_consume(i, r->output);
+    m->output = r->output;
+  } else {
+    m->error = *fail;
+  }
+
+  mpc_furthest_copy(&m->furthest, f);
+  mpc_furthest_merge_all(e, f);
+
+  mpc_memo_insert(i, m);
+  if (ok) { mpc_memo_lend(i, m); }
+}
+
+static void mpc_trie_delete(mpc_trie_t *t) {
+  if (t == NULL) { return; }
+  free(t->alt);
+  free(t->edges);
+  free(t->keys);
+  free(t->kids);
+  free(t);
+}
+
+/*
+** The first alternative from `j` on whose literal the
+** input starts with, or `n` if there is none.
+*/
+static int mpc_trie_match(mpc_trie_t *t, const unsigned char *u, long len, int j, int n) {
+  
+  int node = 0, best = n, lo, hi, mid;
+  long k;
+  
+  for (k = 0; k < len; k++) {
     
-    case MPC_TYPE_COUNT:
-      
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+    lo = t->edges[node];
+    hi = t->edges[node+1];
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (t->keys[mid] < u[k]) { lo = mid + 1; } else { hi = mid; }
+    }
+    
+    if (lo == t->edges[node+1] || t->keys[lo] != u[k]) { break; }
+    node = t->kids[lo];
+    if (t->alt[node] >= j && t->alt[node] < best) { best = t->alt[node]; }
+  }
+  
+  return best;
+}
+
+static void mpc_dispatch_delete(mpc_dispatch_t *d, int n) {
+  int j, k;
+  if (d == NULL) { return; }
+  for (j = 0; j < n; j++) {
+    for (k = 0; k < d->expected_num[j]; k++) { free(d->expected[j][k]); }
+    free(d->expected[j]);
+  }
+  free(d->expected);
+  free(d->expected_num);
+  free(d->skip);
+  free(d->literal);
+  free(d->others);
+  mpc_trie_delete(d->trie);
+  free(d);
+}
+
+#define MPC_DISPATCH_SKIP(d, j, c) ((d)->skip[j][(c) >> 3] & (1 << ((c) & 7)))
+
+/*
+** Finds the first alternative from `j` on that can
+** match, merging in the errors of those passed over.
+**
+** Literals are only matched whole on in-memory input &
+** with backtracking on, as otherwise a literal that
+** fails part way leaves the input moved. When merging
+** cannot change the error the alternatives between are
+** not visited at all.
+*/
+static int mpc_dispatch_next(mpc_input_t *i, mpc_parser_t *p, int j, mpc_furthest_t *e) {
+  
+  mpc_dispatch_t *d = p->data.or.d;
+  int k, lit = -1;
+  unsigned char c;
+  
+  if (d == NULL) { return j; }
+  
+  c = (unsigned char)mpc_input_peekc(i);
+  
+  if (d->trie && i->backtrack > 0
+  && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)) {
+    lit = mpc_trie_match(d->trie, (const unsigned char*)i->string + i->state.pos,
+      i->length - i->state.pos, j, p->data.or.n);
+  }
+  
+  if (lit >= 0 && (i->suppress || e->state.pos > i->state.pos)) {
+    for (k = 0; k < d->others_num && d->others[k] < lit; k++) {
+      if (d->others[k] >= j && !MPC_DISPATCH_SKIP(d, d->others[k], c)) { return d->others[k]; }
+    }
+    return lit;
+  }
+  
+  while (j < p->data.or.n) {
+    if (lit >= 0 && d->literal[j]) {
+      if (j == lit) { break; }
+    } else if (!MPC_DISPATCH_SKIP(d, j, c)) {
+      break;
+    }
+    mpc_furthest_merge_expected(i, e, d->expected[j], d->expected_num[j]);
+    j++;
+  }
+  
+  return j;
+}
+
+#undef MPC_DISPATCH_SKIP
+
+/*
+** Tokens
+**
+** A grammar built with `MPCA_LANG_TOKENIZE` matches its
+** literals & regexes against tokens rather than running
+** them a character at a time. Where a parse is over
+** input held in memory, the input is lexed ahead into
+** a small table of tokens keyed by offset, skipping the
+** whitespace after each in bulk.
+**
+** A token is the longest match of any kind, so a kind
+** matching a shorter prefix, or none, runs as it would
+** without the lexer. Results & errors are the same
+** either way; the lexer only saves the work.
+*/
+
+enum {
+  MPC_TOKENS_SLOTS = 1024,
+  MPC_TOKENS_AHEAD = 64
+};
+
+static void mpc_dfa_delete(mpc_dfa_t *d);
+
+static void mpc_lexer_release(mpc_lexer_t *l) {
+  int j;
+  if (--l->refs > 0) { return; }
+  for (j = 0; j < l->num; j++) {
+    free(l->kinds[j].lit);
+    if (l->kinds[j].dfa) { mpc_dfa_delete(l->kinds[j].dfa); }
+  }
+  free(l->kinds);
+  free(l->cands);
+  free(l);
+}
+
+static void mpc_lexer_ready(mpc_lexer_t *l) {
+
+  int k, c, n = 0;
+  mpc_lex_kind_t *x;
+
+  l->cands = malloc(sizeof(int) * (l->num * 256 + 1));
+
+  for (c = 0; c < 256; c++) {
+    l->starts[c] = n;
+    for (k = 0; k < l->num; k++) {
+      x = &l->kinds[k];
+      if (x->dfa ? x->dfa->trans[c] >= 0 : (unsigned char)x->lit[0] == c) {
+        l->cands[n++] = k;
       }
-      
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
+    }
+  }
+  l->starts[256] = n;
+}
+
+/* The length of the whitespace, as `mpc_whitespace` matches it, at `s` */
+static long mpc_space_run(const unsigned char *s, long n) {
+
+  long k = 0;
+
+#ifdef MPC_HAVE_SSE2
+  __m128i x, t, m;
+  int mask;
+  while (k + 16 <= n) {
+    x = _mm_loadu_si128((const __m128i*)(s + k));
+    t = _mm_sub_epi8(x, _mm_set1_epi8(9));
+    m = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+    mask = _mm_movemask_epi8(m);
+    if (mask != 0xFFFF) { return k + __builtin_ctz(~mask); }
+    k += 16;
+  }
+#endif
+
+  /* `strchr` finds the terminator too, so a zero byte counts */
+  while (k < n && (s[k] == ' ' || (s[k] >= '\t' && s[k] <= '\r') || s[k] == '\0')) { k++; }
+  return k;
+}
+
+static void mpc_lexer_run(mpc_lexer_t *l, const unsigned char *s, long len, long pos, mpc_token_t *t) {
+
+  int j, k, state, next;
+  long n, acc, best = 0;
+  mpc_lex_kind_t *x;
+  mpc_dfa_t *d;
+
+  t->offset = pos;
+  t->length = 0;
+  t->space = 0;
+  t->kinds = 0;
+  t->kind = -1;
+  t->stop = 0;
+  t->expected = NULL;
+
+  if (pos >= len) { return; }
+
+  for (j = l->starts[s[pos]]; j < l->starts[s[pos] + 1]; j++) {
+
+    k = l->cands[j];
+    x = &l->kinds[k];
+    d = x->dfa;
+    state = 0;
+    n = 0;
+
+    if (d) {
+      acc = -1;
+      for (n = 0; pos + n < len; n++) {
+        next = d->trans[state * 256 + s[pos + n]];
+        if (next < 0) { break; }
+        state = next;
+        if (d->accept[state]) { acc = n + 1; }
       }
-      
-    /* Combinatory Parsers */
-    
-    case MPC_TYPE_OR:
-      
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        } 
+      if (acc <= 0) { continue; }
+    } else {
+      if (x->len > len - pos || memcmp(s + pos, x->lit, x->len) != 0) { continue; }
+      acc = x->len;
+    }
+
+    if (acc > best) {
+      best = acc;
+      t->kinds = 0;
+      t->kind = k;
+      t->stop = n;
+      t->expected = d ? d->expected[state] : NULL;
+    }
+    if (acc == best) { t->kinds |= 1UL << k; }
+  }
+
+  t->length = best;
+  if (t->kinds) { t->space = mpc_space_run(s + pos + best, len - pos - best); }
+}
+
+/*
+** The token at the current position. On a miss, the
+** tokens following it are lexed too, since a parse
+** mostly carries on from one token to the next.
+*/
+static mpc_token_t *mpc_input_lex(mpc_input_t *i, mpc_lexer_t *l) {
+
+  const unsigned char *s = (const unsigned char*)i->string;
+  long pos = i->state.pos;
+  mpc_token_t *t;
+  int j;
+
+  if (i->lexer != l) {
+    if (i->tokens == NULL) { i->tokens = malloc(sizeof(mpc_token_t) * MPC_TOKENS_SLOTS); }
+    for (j = 0; j < MPC_TOKENS_SLOTS; j++) { i->tokens[j].offset = -1; }
+    i->lexer = l;
+  }
+
+
+  t = &i->tokens[pos & (MPC_TOKENS_SLOTS-1)];
+  if (t->offset == pos) { return t; }
+
+  for (j = 0; j < MPC_TOKENS_AHEAD; j++) {
+    mpc_token_t *u = &i->tokens[pos & (MPC_TOKENS_SLOTS-1)];
+    mpc_lexer_run(l, s, i->length, pos, u);
+    if (u->kinds == 0) { break; }
+    pos += u->length + u->space;
+  }
+
+  /* Lexing far enough ahead can wrap around onto the first */
+  if (t->offset != i->state.pos) { mpc_lexer_run(l, s, i->length, i->state.pos, t); }
+  return t;
+}
+
+/*
+** Returns -1 where the token parser must run as it
+** would without the lexer. A regex tied with an earlier
+** kind does not know where it would have stopped, so
+** runs too, as does any token without backtracking,
+** where a failed attempt keeps what it consumed.
+*/
+static int mpc_input_token(mpc_input_t *i, mpc_pdata_token_t *p, mpc_result_t *r, mpc_furthest_t *e) {
+
+  mpc_token_t *t;
+  mpc_state_t start;
+  mpc_fail_t err;
+  const char *u;
+  char last;
+  int dfa;
+
+  if (p->kind < 0 || i->backtrack < 1) { return -1; }
+  if (i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP) { return -1; }
+
+  t = mpc_input_lex(i, p->l);
+  if (!(t->kinds & (1UL << p->kind))) { return -1; }
+  dfa = p->l->kinds[p->kind].dfa != NULL;
+  if (dfa && t->kind != p->kind) { return -1; }
+
+  u = i->string + i->state.pos;
+
+  /* As `mpc_parse_dfa` does on success */
+  if (dfa && t->expected && e->state.pos <= t->offset + t->stop) {
+    start = i->state;
+    last = i->last;
+    mpc_input_advance(i, u, t->stop);
+    mpc_fail_expected(i, &err, t->expected);
+    i->state = start;
+    i->last = last;
+    mpc_furthest_merge(e, &err);
+  }
+
+  r->output = mpc_malloc(i, t->length + 1);
+  memcpy(r->output, u, t->length);
+  ((char*)r->output)[t->length] = '\0';
+  mpc_input_advance(i, u, t->length + t->space);
+  return 1;
+}
+
+/*
+** Profiling
+**
+** A parse given an `mpc_profile_t` counts & times each
+** parser it enters. Calls are kept on a stack of their
+** own, so each one can take the time spent in its
+** children away from its own. The named rules being
+** parsed are followed down a tree of paths, giving the
+** time spent under each chain of rules.
+**
+** Times come from `clock` unless `MPC_PROFILE_CLOCK`
+** is defined along with `MPC_PROFILE_CLOCKS_PER_SEC`.
+*/
+
+#ifndef MPC_PROFILE_CLOCK
+#define MPC_PROFILE_CLOCK() ((unsigned long)clock())
+#define MPC_PROFILE_CLOCKS_PER_SEC ((double)CLOCKS_PER_SEC)
+#endif
+
+typedef struct {
+  mpc_parser_t *p;
+  int parent;
+  int active;
+  unsigned long calls;
+  unsigned long successes;
+  unsigned long failures;
+  unsigned long rewinds;
+  unsigned long bytes;
+  unsigned long self;
+  unsigned long total;
+} mpc_profile_node_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  int parent;
+  int child;
+  int next;
+  unsigned long self;
+} mpc_profile_path_t;
+
+typedef struct {
+  int node;
+  int path;
+  long pos;
+  unsigned long start;
+  unsigned long children;
+} mpc_profile_call_t;
+
+struct mpc_profile_t {
+  mpc_profile_node_t *nodes;
+  int nodes_num;
+  int nodes_slots;
+  int *index;
+  int index_slots;
+  mpc_profile_path_t *paths;
+  int paths_num;
+  int paths_slots;
+  mpc_profile_call_t *calls;
+  int calls_num;
+  int calls_slots;
+};
+
+enum {
+  MPC_PROFILE_INDEX_MIN = 64,
+  MPC_PROFILE_PATHS_MIN = 16,
+  MPC_PROFILE_CALLS_MIN = 64
+};
+
+mpc_profile_t *mpc_profile_new(void) {
+
+  int j;
+  mpc_profile_t *f = malloc(sizeof(mpc_profile_t));
+
+  f->nodes = NULL;
+  f->nodes_num = 0;
+  f->nodes_slots = 0;
+
+  f->index_slots = MPC_PROFILE_INDEX_MIN;
+  f->index = malloc(sizeof(int) * f->index_slots);
+  for (j = 0; j < f->index_slots; j++) { f->index[j] = -1; }
+
+  /* The first path is taken before any rule is entered */
+  f->paths_slots = MPC_PROFILE_PATHS_MIN;
+  f->paths = malloc(sizeof(mpc_profile_path_t) * f->paths_slots);
+  f->paths_num = 1;
+  f->paths[0].p = NULL;
+  f->paths[0].parent = -1;
+  f->paths[0].child = -1;
+  f->paths[0].next = -1;
+  f->paths[0].self = 0;
+
+  f->calls_slots = MPC_PROFILE_CALLS_MIN;
+  f->calls = malloc(sizeof(mpc_profile_call_t) * f->calls_slots);
+  f->calls_num = 0;
+
+  return f;
+}
+
+void mpc_profile_delete(mpc_profile_t *f) {
+  free(f->nodes);
+  free(f->index);
+  free(f->paths);
+  free(f->calls);
+  free(f);
+}
+
+static int mpc_profile_hash(mpc_profile_t *f, mpc_parser_t *p) {
+  size_t h = ((size_t)p >> 4) * 2654435761u;
+  return (int)(h & (size_t)(f->index_slots - 1));
+}
+
+static void mpc_profile_reindex(mpc_profile_t *f) {
+
+  int j, h;
+
+  f->index_slots *= 2;
+  f->index = realloc(f->index, sizeof(int) * f->index_slots);
+  for (j = 0; j < f->index_slots; j++) { f->index[j] = -1; }
+
+  for (j = 0; j < f->nodes_num; j++) {
+    h = mpc_profile_hash(f, f->nodes[j].p);
+    while (f->index[h] >= 0) { h = (h + 1) & (f->index_slots - 1); }
+    f->index[h] = j;
+  }
+}
+
+/*
+** Parsers are looked up by address in an index kept
+** at most half full. One seen for the first time
+** remembers the parser it was entered from.
+*/
+static int mpc_profile_node(mpc_profile_t *f, mpc_parser_t *p, int parent) {
+
+  int h, j;
+  mpc_profile_node_t *n;
+
+  h = mpc_profile_hash(f, p);
+  while (f->index[h] >= 0) {
+    if (f->nodes[f->index[h]].p == p) { return f->index[h]; }
+    h = (h + 1) & (f->index_slots - 1);
+  }
+
+  if (f->nodes_num == f->nodes_slots) {
+    f->nodes_slots = f->nodes_slots ? f->nodes_slots * 2 : MPC_PROFILE_INDEX_MIN / 2;
+    f->nodes = realloc(f->nodes, sizeof(mpc_profile_node_t) * f->nodes_slots);
+  }
+
+  j = f->nodes_num++;
+  n = &f->nodes[j];
+  n->p = p;
+  n->parent = parent;
+  n->active = 0;
+  n->calls = 0;
+  n->successes = 0;
+  n->failures = 0;
+  n->rewinds = 0;
+  n->bytes = 0;
+  n->self = 0;
+  n->total = 0;
+
+  f->index[h] = j;
+  if (f->nodes_num * 2 > f->index_slots) { mpc_profile_reindex(f); }
+  return j;
+}
+
+static int mpc_profile_path(mpc_profile_t *f, int parent, mpc_parser_t *p) {
+
+  int j;
+  mpc_profile_path_t *x;
+
+  for (j = f->paths[parent].child; j >= 0; j = f->paths[j].next) {
+    if (f->paths[j].p == p) { return j; }
+  }
+
+  if (f->paths_num == f->paths_slots) {
+    f->paths_slots *= 2;
+    f->paths = realloc(f->paths, sizeof(mpc_profile_path_t) * f->paths_slots);
+  }
+
+  j = f->paths_num++;
+  x = &f->paths[j];
+  x->p = p;
+  x->parent = parent;
+  x->child = -1;
+  x->next = f->paths[parent].child;
+  x->self = 0;
+  f->paths[parent].child = j;
+  return j;
+}
+
+static void mpc_profile_enter(mpc_profile_t *f, mpc_parser_t *p, long pos) {
+
+  mpc_profile_call_t *c, *top;
+  int node, path;
+
+  top = f->calls_num ? &f->calls[f->calls_num-1] : NULL;
+  node = mpc_profile_node(f, p, top ? top->node : -1);
+  path = top ? top->path : 0;
+  if (p->name) { path = mpc_profile_path(f, path, p); }
+
+  if (f->calls_num == f->calls_slots) {
+    f->calls_slots *= 2;
+    f->calls = realloc(f->calls, sizeof(mpc_profile_call_t) * f->calls_slots);
+  }
+
+  c = &f->calls[f->calls_num++];
+  c->node = node;
+  c->path = path;
+  c->pos = pos;
+  c->children = 0;
+  f->nodes[node].calls++;
+  f->nodes[node].active++;
+  c->start = MPC_PROFILE_CLOCK();
+}
+
+/* A parser that is still running further up is only timed in total once */
+static void mpc_profile_exit(mpc_profile_t *f, int ok, long pos) {
+
+  unsigned long elapsed = MPC_PROFILE_CLOCK();
+  mpc_profile_call_t *c = &f->calls[--f->calls_num];
+  mpc_profile_node_t *n = &f->nodes[c->node];
+  unsigned long self;
+
+  elapsed -= c->start;
+  self = elapsed > c->children ? elapsed - c->children : 0;
+
+  if (ok) {
+    n->successes++;
+    n->bytes += pos - c->pos;
+  } else {
+    n->failures++;
+  }
+
+  n->self += self;
+  f->paths[c->path].self += self;
+  if (--n->active == 0) { n->total += elapsed; }
+  if (f->calls_num) { f->calls[f->calls_num-1].children += elapsed; }
+}
+
+/* Input given back is counted against the call giving it back */
+static void mpc_profile_rewind(mpc_profile_t *f) {
+  f->nodes[f->calls[f->calls_num-1].node].rewinds++;
+}
+
+/*
+** Parsing runs as a loop over an explicit stack kept
+** on the heap rather than by recursion, so how deeply
+** input can nest is limited by memory rather than the
+** size of the C stack.
+**
+** Each step either enters a parser or returns a result
+** to the frame on top of the stack. Primitives finish
+** as soon as they are entered; combinators push a
+** frame saying what they are waiting on & enter their
+** first child, then carry on each time one returns.
+**
+** Values collected by `many`, `count` & `and` go on a
+** second stack. A child always finishes before its
+** parent carries on, so each frame's values form one
+** run at the top of the stack & are folded in place.
+*/
+
+typedef struct {
+  mpc_parser_t *p;
+  int j;
+  int vals;
+  int err;
+  int memo_err;
+  long memo_pos;
+  int memo_flags;
+  int spans;
+} mpc_frame_t;
+
+typedef struct {
+  mpc_frame_t *frames;
+  int frames_num;
+  int frames_slots;
+  mpc_val_t **vals;
+  int vals_num;
+  int vals_slots;
+  mpc_furthest_t *furthest;
+  int furthest_num;
+  int furthest_slots;
+} mpc_stack_t;
+
+enum {
+  MPC_PARSE_FRAMES_MIN = 256,
+  MPC_PARSE_VALS_MIN   = 256
+};
+
+/*
+** Errors are merged into the caller's error, except
+** under a memo frame, which collects its own on a
+** third stack. `err` names the error used by index
+** into that stack, or is -1 for the caller's.
+*/
+static mpc_frame_t *mpc_stack_push(mpc_stack_t *s, mpc_parser_t *p, int err) {
+
+  mpc_frame_t *f;
+
+  if (s->frames_num == s->frames_slots) {
+    s->frames_slots *= 2;
+    s->frames = realloc(s->frames, sizeof(mpc_frame_t) * s->frames_slots);
+  }
+
+  f = &s->frames[s->frames_num++];
+  f->p = p;
+  f->j = 0;
+  f->vals = s->vals_num;
+  f->err = err;
+  return f;
+}
+
+/* Slots are reused as they are, keeping any expected strings allocated */
+static int mpc_stack_push_furthest(mpc_stack_t *s) {
+
+  mpc_furthest_t *f;
+  int j;
+
+  if (s->furthest_num == s->furthest_slots) {
+    s->furthest_slots = s->furthest_slots ? s->furthest_slots * 2 : 16;
+    s->furthest = realloc(s->furthest, sizeof(mpc_furthest_t) * s->furthest_slots);
+    for (j = s->furthest_num; j < s->furthest_slots; j++) {
+      mpc_furthest_init(&s->furthest[j]);
+    }
+  }
+
+  f = &s->furthest[s->furthest_num];
+  f->state = mpc_state_invalid();
+  f->failure = NULL;
+  f->expected_num = 0;
+  return s->furthest_num++;
+}
+
+static void mpc_stack_push_val(mpc_stack_t *s, mpc_val_t *x) {
+  if (s->vals_num == s->vals_slots) {
+    s->vals_slots *= 2;
+    s->vals = realloc(s->vals, sizeof(mpc_val_t*) * s->vals_slots);
+  }
+  s->vals[s->vals_num++] = x;
+}
+
+#define MPC_FRAME_SPANS(f) ((f)->p->type == MPC_TYPE_AND || (f)->p->type == MPC_TYPE_COUNT || (f)->p->type == MPC_TYPE_NOT)
+#define MPC_FRAME_RECOVERS(f) ((f)->p->type == MPC_TYPE_OR || (f)->p->type == MPC_TYPE_MAYBE \
+  || (f)->p->type == MPC_TYPE_MANY || (f)->p->type == MPC_TYPE_MANY1 || (f)->p->type == MPC_TYPE_NOT)
+
+/*
+** When a frame fails with no parent able to try
+** something else, the whole parse fails. So only the
+** frames after the first one that can recover may
+** still drop spans. Everything logged before them is
+** sent, & the marks of the frames move down to match.
+*/
+static void mpc_stack_send_spans(mpc_stack_t *s, mpc_input_t *i) {
+
+  int k, n = i->spans_num, recover = 0;
+  mpc_frame_t *f;
+
+  for (k = 0; k < s->frames_num; k++) {
+    f = &s->frames[k];
+    if (MPC_FRAME_SPANS(f) && recover) { n = f->spans; break; }
+    if (MPC_FRAME_RECOVERS(f)) { recover = 1; }
+  }
+
+  if (n == 0) { return; }
+  mpc_input_send_spans(i, n);
+
+  for (k = 0; k < s->frames_num; k++) {
+    f = &s->frames[k];
+    if (MPC_FRAME_SPANS(f)) { f->spans = f->spans > n ? f->spans - n : 0; }
+  }
+}
+
+#undef MPC_FRAME_SPANS
+#undef MPC_FRAME_RECOVERS
+
+/* Enter `x` as the next child of the frame on top */
+#define MPC_ENTER(x) \
+  err = (f->p->type == MPC_TYPE_MEMO) ? f->memo_err : f->err; \
+  p = (x); entering = 1; continue
+
+#define MPC_POP() \
+  s.vals_num = f->vals; \
+  s.frames_num--
+
+#define MPC_ERR(x) ((x) < 0 ? e : &s.furthest[x])
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r,
+  mpc_fail_t *fail, mpc_furthest_t *e) {
+
+  mpc_stack_t s;
+  mpc_frame_t *f;
+  mpc_memo_t *m;
+  mpc_furthest_t *ep;
+  int entering = 1, err = -1, ok = 0, k;
+
+  s.frames = malloc(sizeof(mpc_frame_t) * MPC_PARSE_FRAMES_MIN);
+  s.frames_num = 0;
+  s.frames_slots = MPC_PARSE_FRAMES_MIN;
+  s.vals = malloc(sizeof(mpc_val_t*) * MPC_PARSE_VALS_MIN);
+  s.vals_num = 0;
+  s.vals_slots = MPC_PARSE_VALS_MIN;
+  s.furthest = NULL;
+  s.furthest_num = 0;
+  s.furthest_slots = 0;
+
+  while (1) {
+
+    if (entering) {
+
+      entering = 0;
+      ep = MPC_ERR(err);
+      if (i->profile) { mpc_profile_enter(i->profile, p, i->state.pos); }
+
+      switch (p->type) {
+
+        /* Basic Parsers */
+
+        case MPC_TYPE_ANY:     ok = mpc_input_any(i, (char**)&r->output); break;
+        case MPC_TYPE_SINGLE:  ok = mpc_input_char(i, p->data.single.x, (char**)&r->output); break;
+        case MPC_TYPE_RANGE:   ok = mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output); break;
+        case MPC_TYPE_ONEOF:   ok = mpc_input_oneof(i, p->data.string.x, (char**)&r->output); break;
+        case MPC_TYPE_NONEOF:  ok = mpc_input_noneof(i, p->data.string.x, (char**)&r->output); break;
+        case MPC_TYPE_SATISFY: ok = mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output); break;
+        case MPC_TYPE_STRING:  ok = mpc_input_string(i, p->data.string.x, (char**)&r->output); break;
+        case MPC_TYPE_ANCHOR:  ok = mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output); break;
+        case MPC_TYPE_DFA:     ok = mpc_parse_dfa(i, p->data.dfa.x, r, fail, ep); continue;
+
+        case MPC_TYPE_TOKEN:
+          ok = mpc_input_token(i, &p->data.token, r, ep);
+          if (ok >= 0) { continue; }
+          f = mpc_stack_push(&s, p, err);
+          MPC_ENTER(p->data.token.x);
+
+        /* Other parsers */
+
+        case MPC_TYPE_UNDEFINED: ok = 0; mpc_fail_failure(i, fail, "Parser Undefined!"); continue;
+        case MPC_TYPE_PASS:      ok = 1; r->output = NULL; continue;
+        case MPC_TYPE_FAIL:      ok = 0; mpc_fail_failure(i, fail, p->data.fail.m); continue;
+        case MPC_TYPE_LIFT:      ok = 1; r->output = p->data.lift.lf(); continue;
+        case MPC_TYPE_LIFT_VAL:  ok = 1; r->output = p->data.lift.x; continue;
+        case MPC_TYPE_STATE:     ok = 1; r->output = mpc_input_state_copy(i); continue;
+
+        /* Combinators wait on their first child */
+
+        case MPC_TYPE_APPLY:    f = mpc_stack_push(&s, p, err); MPC_ENTER(p->data.apply.x);
+        case MPC_TYPE_APPLY_TO: f = mpc_stack_push(&s, p, err); MPC_ENTER(p->data.apply_to.x);
+
+        case MPC_TYPE_EXPECT:
+          mpc_input_suppress_enable(i);
+          f = mpc_stack_push(&s, p, err);
+          MPC_ENTER(p->data.expect.x);
+
+        case MPC_TYPE_PREDICT:
+          mpc_input_backtrack_disable(i);
+          f = mpc_stack_push(&s, p, err);
+          MPC_ENTER(p->data.predict.x);
+
+        case MPC_TYPE_NOT:
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          f = mpc_stack_push(&s, p, err);
+          f->spans = i->spans_num;
+          MPC_ENTER(p->data.not.x);
+
+        case MPC_TYPE_MAYBE:
+          f = mpc_stack_push(&s, p, err);
+          MPC_ENTER(p->data.not.x);
+
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+        case MPC_TYPE_COUNT:
+          f = mpc_stack_push(&s, p, err);
+          f->spans = i->spans_num;
+          MPC_ENTER(p->data.repeat.x);
+
+        case MPC_TYPE_OR:
+          if (p->data.or.n == 0) { ok = 1; r->output = NULL; continue; }
+          k = mpc_dispatch_next(i, p, 0, ep);
+          if (k == p->data.or.n) { ok = 0; mpc_fail_none(fail); continue; }
+          f = mpc_stack_push(&s, p, err);
+          f->j = k;
+          MPC_ENTER(p->data.or.xs[k]);
+
+        case MPC_TYPE_AND:
+          if (p->data.and.n == 0) { ok = 1; r->output = NULL; continue; }
+          mpc_input_mark(i);
+          f = mpc_stack_push(&s, p, err);
+          f->spans = i->spans_num;
+          MPC_ENTER(p->data.and.xs[0]);
+
+        case MPC_TYPE_MEMO:
+          /* Replays would miss the spans logged inside */
+          if (i->event) { p = p->data.memo.x; entering = 1; continue; }
+          k = mpc_memo_flags(i);
+          m = mpc_memo_find(i, p->data.memo.k ? p->data.memo.k : p, k);
+          if (m && (!m->ok || m->status == MPC_MEMO_HELD)) {
+            ok = mpc_memo_replay(i, m, r, fail, ep);
+            continue;
+          }
+          i->memo_misses++;
+          /* The result is in use or was given up - parse again for another */
+          if (m) { mpc_memo_remove(i, m); }
+          f = mpc_stack_push(&s, p, err);
+          f->memo_err = mpc_stack_push_furthest(&s);
+          f->memo_pos = i->state.pos;
+          f->memo_flags = k;
+          MPC_ENTER(p->data.memo.x);
+
+        default:
+          ok = 0;
+          mpc_fail_failure(i, fail, "Unknown Parser Type Id!");
+          continue;
       }
-      
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_AND:
-      
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
+
+      /* Primitives leave no error of their own */
+      if (!ok) { mpc_fail_none(fail); }
+      continue;
+    }
+
+    /* Return the result to the frame waiting on it */
+
+    if (i->profile) { mpc_profile_exit(i->profile, ok, i->state.pos); }
+    if (s.frames_num == 0) { break; }
+
+    f = &s.frames[s.frames_num-1];
+    p = f->p;
+    ep = MPC_ERR(f->err);
+
+    switch (p->type) {
+
+      /* Application Parsers */
+
+      case MPC_TYPE_APPLY:
+        MPC_POP();
+        if (ok) { r->output = mpc_parse_apply(i, p->data.apply.f, r->output); }
+        break;
+
+      case MPC_TYPE_APPLY_TO:
+        MPC_POP();
+        if (ok) { r->output = mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d); }
+        break;
+
+      case MPC_TYPE_EXPECT:
+        MPC_POP();
+        mpc_input_suppress_disable(i);
+        if (!ok) { mpc_fail_expected(i, fail, p->data.expect.m); }
+        break;
+
+      case MPC_TYPE_PREDICT:
+        MPC_POP();
+        mpc_input_backtrack_enable(i);
+        break;
+
+      case MPC_TYPE_TOKEN:
+        MPC_POP();
+        break;
+
+      /* Optional Parsers */
+
+      /* TODO: Update Not Error Message */
+
+      case MPC_TYPE_NOT:
+        MPC_POP();
+        if (ok) {
           mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          mpc_input_suppress_disable(i);
+          mpc_parse_dtor(i, p->data.not.dx, r->output);
+          i->spans_num = f->spans;
+          ok = 0;
+          mpc_fail_expected(i, fail, "opposite");
+        } else {
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          ok = 1;
+          r->output = p->data.not.lf();
         }
-      }
-      mpc_input_unmark(i); 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    /* End */
-    
-    default:
-      
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+        break;
+
+      case MPC_TYPE_MAYBE:
+        MPC_POP();
+        if (!ok) {
+          mpc_furthest_merge(ep, fail);
+          ok = 1;
+          r->output = p->data.not.lf();
+        }
+        break;
+
+      /* Repeat Parsers */
+
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+
+        if (ok) {
+          mpc_stack_push_val(&s, r->output);
+          f->j++;
+          MPC_ENTER(p->data.repeat.x);
+        }
+
+        if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+          MPC_POP();
+          mpc_fail_many1(i, fail);
+          break;
+        }
+
+        mpc_furthest_merge(ep, fail);
+        ok = 1;
+        r->output = mpc_parse_fold(i, p->data.repeat.f, f->j, s.vals + f->vals);
+        MPC_POP();
+        break;
+
+      case MPC_TYPE_COUNT:
+
+        if (ok) {
+          mpc_stack_push_val(&s, r->output);
+          f->j++;
+          if (f->j < p->data.repeat.n) { MPC_ENTER(p->data.repeat.x); }
+          r->output = mpc_parse_fold(i, p->data.repeat.f, f->j, s.vals + f->vals);
+          MPC_POP();
+          break;
+        }
+
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, s.vals[f->vals + k]);
+        }
+        i->spans_num = f->spans;
+        MPC_POP();
+        mpc_fail_count(i, fail, p->data.repeat.n);
+        break;
+
+      /* Combinatory Parsers */
+
+      case MPC_TYPE_OR:
+
+        if (ok) { MPC_POP(); break; }
+
+        mpc_furthest_merge(ep, fail);
+        f->j = mpc_dispatch_next(i, p, f->j + 1, ep);
+        if (f->j < p->data.or.n) { MPC_ENTER(p->data.or.xs[f->j]); }
+
+        MPC_POP();
+        mpc_fail_none(fail);
+        break;
+
+      case MPC_TYPE_AND:
+
+        if (ok) {
+          mpc_stack_push_val(&s, r->output);
+          f->j++;
+          if (f->j < p->data.and.n) { MPC_ENTER(p->data.and.xs[f->j]); }
+          mpc_input_unmark(i);
+          r->output = mpc_parse_fold(i, p->data.and.f, f->j, s.vals + f->vals);
+          MPC_POP();
+          if (i->event && i->spans_num == i->spans_slots) { mpc_stack_send_spans(&s, i); }
+          break;
+        }
+
+        mpc_input_rewind(i);
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.and.dxs[k], s.vals[f->vals + k]);
+        }
+        i->spans_num = f->spans;
+        MPC_POP();
+        break;
+
+      case MPC_TYPE_MEMO:
+        MPC_POP();
+        mpc_memo_record(i, p, f->memo_pos, f->memo_flags, ok, r, fail, &s.furthest[f->memo_err], ep);
+        s.furthest_num--;
+        break;
+
+      default: break;
+    }
   }
-  
-  return 0;
-  
+
+  for (k = 0; k < s.furthest_slots; k++) { mpc_furthest_delete(&s.furthest[k]); }
+  free(s.frames);
+  free(s.vals);
+  free(s.furthest);
+
+  return ok;
+
 }
 
-#undef MPC_SUCCESS
-#undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+#undef MPC_ENTER
+#undef MPC_POP
+#undef MPC_ERR
+
+/*
+** Trees memoised during the parse point into the
+** arena, so the entries are dropped before the arena
+** is handed on with the result or freed on failure.
+*/
+static void mpc_input_arena_release(mpc_input_t *i, mpc_result_t *r) {
+  if (i->memo_new) {
+    mpc_memo_clear(i, i->memo_new);
+    mpc_memo_clear(i, i->memo_old);
+    i->memo_num = 0;
+  }
+  if (r) {
+    r->arena = i->arena;
+  } else {
+    mpc_arena_delete(i->arena);
+  }
+  i->arena = NULL;
+}
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
+  mpc_fail_t fail;
+  mpc_furthest_t e;
+  mpc_fail_none(&fail);
+  mpc_furthest_init(&e);
+  e.failure = "Unknown Error";
+  i->arena = p->arena && !i->event ? mpc_arena_new() : NULL;
+  r->arena = NULL;
+  x = mpc_parse_run(i, p, r, &fail, &e);
+  mpc_memo_release(i);
   if (x) {
-    mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    mpc_furthest_merge(&e, &fail);
+    r->error = mpc_furthest_err(i, &e);
   }
+  mpc_furthest_delete(&e);
+  if (i->arena) { mpc_input_arena_release(i, x ? r : NULL); }
   return x;
 }
 
@@ -1278,19 +3193,156 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
   return x;
 }
 
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_pipe_each(const char *filename, FILE *pipe, mpc_parser_t *p,
+  int (*f)(mpc_val_t*, void*), void *data, mpc_result_t *r) {
   
-  FILE *f = fopen(filename, "rb");
+  int x = 1, more;
+  mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
+  
+  while (x && !mpc_input_terminated(i)) {
+    x = mpc_parse_input(i, p, r);
+    if (!x) { break; }
+    more = f(r->output, data);
+    /* `f` is done with a tree built in an arena once it returns */
+    if (r->arena) {
+      mpc_arena_delete(r->arena);
+      r->arena = NULL;
+    }
+    if (!more) { break; }
+  }
+  
+  mpc_input_delete(i);
+  return x;
+}
+
+static int mpc_parse_contents_profile_to(const char *filename, mpc_parser_t *p, mpc_profile_t *prof, mpc_result_t *r) {
+  
+  FILE *f;
+  mpc_input_t *i;
   int res;
   
+#ifdef MPC_HAVE_MMAP
+  /* Regular files are mapped & read in place; fall back to stdio otherwise */
+  int fd = open(filename, O_RDONLY);
+  if (fd >= 0) {
+    i = mpc_input_new_mmap(filename, fd);
+    close(fd);
+    if (i) {
+      i->profile = prof;
+      res = mpc_parse_input(i, p, r);
+      mpc_input_delete(i);
+      return res;
+    }
+  }
+#endif
+  
+  f = fopen(filename, "rb");
   if (f == NULL) {
     r->output = NULL;
+    r->arena = NULL;
     r->error = mpc_err_file(filename, "Unable to open file!");
     return 0;
   }
-  
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
+  
+  /* Files that cannot seek, such as named pipes, are read as pipes */
+  if (fseek(f, 0, SEEK_CUR) != 0) {
+    i = mpc_input_new_pipe(filename, f);
+  } else {
+    i = mpc_input_new_file(filename, f);
+  }
+  i->profile = prof;
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  fclose(f);
+  return res;
+}
+
+int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_contents_profile_to(filename, p, NULL, r);
+}
+
+/* Profiles build up over every parse they are given */
+int mpc_parse_profile(const char *filename, const char *string, mpc_parser_t *p, mpc_profile_t *prof, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->profile = prof;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
+int mpc_parse_contents_profile(const char *filename, mpc_parser_t *p, mpc_profile_t *prof, mpc_result_t *r) {
+  return mpc_parse_contents_profile_to(filename, p, prof, r);
+}
+
+static int mpca_parse_input_events(mpc_input_t *i, mpc_parser_t *p, mpca_event_t f, void *data, mpc_result_t *r) {
+
+  long start = i->state.pos;
+
+  i->event = f;
+  i->event_data = data;
+  if (!mpc_parse_input(i, p, r)) { return 0; }
+
+  /* The rule parsed from spans everything it matched */
+  if (p->name) { mpc_input_span(i, p, start); }
+  mpc_input_send_spans(i, i->spans_num);
+  return 1;
+}
+
+int mpca_parse_events(const char *filename, const char *string, mpc_parser_t *p, mpca_event_t f, void *data, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpca_parse_input_events(i, p, f, data, r);
+  mpc_input_delete(i);
+  return x;
+}
+
+/* Spans point into the input, so files are always read into memory */
+int mpca_parse_contents_events(const char *filename, mpc_parser_t *p, mpca_event_t f, void *data, mpc_result_t *r) {
+
+  FILE *file;
+  mpc_input_t *i;
+  char *buffer = NULL;
+  size_t len = 0, slots = 0, n = 1;
+  int res;
+
+#ifdef MPC_HAVE_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd >= 0) {
+    i = mpc_input_new_mmap(filename, fd);
+    close(fd);
+    if (i) {
+      res = mpca_parse_input_events(i, p, f, data, r);
+      mpc_input_delete(i);
+      return res;
+    }
+  }
+#endif
+
+  file = fopen(filename, "rb");
+  if (file == NULL) {
+    r->output = NULL;
+    r->arena = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return 0;
+  }
+
+  while (n > 0) {
+    if (len + 1 >= slots) {
+      slots = slots ? slots * 2 : 4096;
+      buffer = realloc(buffer, slots);
+    }
+    n = fread(buffer + len, 1, slots - len - 1, file);
+    len += n;
+  }
+  buffer[len] = '\0';
+  fclose(file);
+
+  i = mpc_input_new_string(filename, buffer);
+  i->length = len;
+  i->owned = 1;
+  res = mpca_parse_input_events(i, p, f, data, r);
+  mpc_input_delete(i);
   return res;
 }
 
@@ -1300,12 +3352,44 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force);
 
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  for (j = 0; j < d->states; j++) { free(d->expected[j]); }
+  free(d->expected);
+  free(d->trans);
+  free(d->accept);
+  free(d->re);
+  free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_copy(const mpc_dfa_t *a) {
+  int j;
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  d->states = a->states;
+  d->trans = malloc(sizeof(int) * 256 * a->states);
+  memcpy(d->trans, a->trans, sizeof(int) * 256 * a->states);
+  d->accept = malloc(a->states);
+  memcpy(d->accept, a->accept, a->states);
+  d->expected = malloc(sizeof(char*) * a->states);
+  for (j = 0; j < a->states; j++) {
+    d->expected[j] = NULL;
+    if (a->expected[j]) {
+      d->expected[j] = malloc(strlen(a->expected[j]) + 1);
+      strcpy(d->expected[j], a->expected[j]);
+    }
+  }
+  d->re = malloc(strlen(a->re) + 1);
+  strcpy(d->re, a->re);
+  return d;
+}
+
 static void mpc_undefine_or(mpc_parser_t *p) {
   
   int i;
   for (i = 0; i < p->data.or.n; i++) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
+  mpc_dispatch_delete(p->data.or.d, p->data.or.n);
   free(p->data.or.xs);
   
 }
@@ -1338,6 +3422,12 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_MEMO:     mpc_undefine_unretained(p->data.memo.x, 0);     break;
+    
+    case MPC_TYPE_TOKEN:
+      mpc_undefine_unretained(p->data.token.x, 0);
+      mpc_lexer_release(p->data.token.l);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1357,6 +3447,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
+    case MPC_TYPE_DFA: mpc_dfa_delete(p->data.dfa.x); break;
     
     default: break;
   }
@@ -1411,6 +3502,8 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   
   p = mpc_undefined();
   p->retained = a->retained;
+  p->arena = a->arena;
+  p->rule = a->rule;
   p->type = a->type;
   p->data = a->data;
   
@@ -1436,6 +3529,13 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_MEMO:     p->data.memo.x     = mpc_copy(a->data.memo.x);     break;
+    case MPC_TYPE_DFA:      p->data.dfa.x      = mpc_dfa_copy(a->data.dfa.x);  break;
+    
+    case MPC_TYPE_TOKEN:
+      p->data.token.x = mpc_copy(a->data.token.x);
+      p->data.token.l->refs++;
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1455,6 +3555,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       break;
     
     case MPC_TYPE_OR:
+      p->data.or.d = NULL;
       p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
@@ -1726,6 +3827,24 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+/*
+** Parsers given the same key share memo entries, so
+** must give the same results. With no key the memo
+** parser is its own.
+*/
+static mpc_parser_t *mpc_memo_keyed(mpc_parser_t *a, mpc_dtor_t d, mpc_parser_t *k) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.d = d;
+  p->data.memo.k = k;
+  return p;
+}
+
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_dtor_t d) {
+  return mpc_memo_keyed(a, d, NULL);
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2093,22 +4212,20 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
-  
-  mpc_parser_t *out;
+/*
+** Expands the body of a regex range, without any
+** leading `^`, into the characters it contains.
+*/
+static char *mpc_re_range_chars(const char *s) {
+
   size_t i, j;
   size_t start, end;
   const char *tmp = NULL;
-  const char *s = x;
   int comp = s[0] == '^' ? 1 : 0;
   char *range = calloc(1,1);
-  
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
-  if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  
+
   for (i = comp; i < strlen(s); i++){
-    
+
     /* Regex Range Escape */
     if (s[i] == '\\') {
       tmp = mpc_re_range_escape_char(s[i+1]);
@@ -2118,11 +4235,11 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
       } else {
         range = realloc(range, strlen(range) + 1 + 1);
         range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
+        range[strlen(range) + 0] = s[i+1];
       }
       i++;
     }
-    
+
     /* Regex Range...Range */
     else if (s[i] == '-') {
       if (s[i+1] == '\0' || i == 0) {
@@ -2135,27 +4252,601 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
           range = realloc(range, strlen(range) + 1 + 1 + 1);
           range[strlen(range) + 1] = '\0';
           range[strlen(range) + 0] = (char)j;
-        }        
+        }
       }
     }
-    
+
     /* Regex Range Normal */
     else {
       range = realloc(range, strlen(range) + 1 + 1);
       range[strlen(range) + 1] = '\0';
       range[strlen(range) + 0] = s[i];
     }
-  
+
   }
-  
+
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+
+  mpc_parser_t *out;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range;
+
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  range = mpc_re_range_chars(s);
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
-  
+
   free(x);
   free(range);
-  
+
+  return out;
+}
+
+/*
+** Compiling Regular Expressions to DFAs
+**
+** The combinators built above try one character at
+** a time through `mpc_parse_run`. Most regexes, such
+** as those of numbers & identifiers, can instead be
+** matched by a table lookup per character.
+**
+** The regex is parsed a second time into a small
+** syntax tree, which is turned into an NFA & then
+** into a DFA by subset construction.
+**
+** The combinators are ordered & greedy, where a DFA
+** finds the longest match. The DFA is only used when
+** the two must agree: when every alternative, repeat
+** & optional part is decided by the next character
+** alone. Anything else - ambiguous regexes, anchors,
+** boundaries, the lookaheads `\D`, `\S` & `\W` and
+** very large automata - falls back to combinators.
+**
+** Sets mirror the primitives they replace exactly,
+** including `mpc_oneof` matching a NUL character.
+*/
+
+enum {
+  MPC_RE_SET   = 0,
+  MPC_RE_CAT   = 1,
+  MPC_RE_ALT   = 2,
+  MPC_RE_MANY  = 3,
+  MPC_RE_MANY1 = 4,
+  MPC_RE_MAYBE = 5
+};
+
+enum {
+  MPC_RE_COUNT_MAX = 64,
+  MPC_DFA_STATES_MAX = 256
+};
+
+#define MPC_RE_SET_HAS(set, c) ((set)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+#define MPC_RE_SET_ADD(set, c) ((set)[(unsigned char)(c) >> 3] |= (unsigned char)(1 << ((unsigned char)(c) & 7)))
+
+typedef struct mpc_re_node_t {
+  int type;
+  unsigned char set[32];
+  int n;
+  struct mpc_re_node_t **xs;
+} mpc_re_node_t;
+
+static mpc_re_node_t *mpc_re_node_new(int type) {
+  mpc_re_node_t *x = malloc(sizeof(mpc_re_node_t));
+  x->type = type;
+  memset(x->set, 0, sizeof(x->set));
+  x->n = 0;
+  x->xs = NULL;
+  return x;
+}
+
+static void mpc_re_node_delete(mpc_re_node_t *x) {
+  int j;
+  if (x == NULL) { return; }
+  for (j = 0; j < x->n; j++) { mpc_re_node_delete(x->xs[j]); }
+  free(x->xs);
+  free(x);
+}
+
+static mpc_re_node_t *mpc_re_node_add(mpc_re_node_t *x, mpc_re_node_t *y) {
+  x->xs = realloc(x->xs, sizeof(mpc_re_node_t*) * (x->n + 1));
+  x->xs[x->n++] = y;
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_node_copy(mpc_re_node_t *a) {
+  int j;
+  mpc_re_node_t *x = mpc_re_node_new(a->type);
+  memcpy(x->set, a->set, sizeof(x->set));
+  for (j = 0; j < a->n; j++) { mpc_re_node_add(x, mpc_re_node_copy(a->xs[j])); }
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_node_oneof(const char *s) {
+  mpc_re_node_t *x = mpc_re_node_new(MPC_RE_SET);
+  while (*s) { MPC_RE_SET_ADD(x->set, *s); s++; }
+  MPC_RE_SET_ADD(x->set, '\0');
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_node_char(char c) {
+  mpc_re_node_t *x = mpc_re_node_new(MPC_RE_SET);
+  MPC_RE_SET_ADD(x->set, c);
+  return x;
+}
+
+static mpc_re_node_t *mpc_re_parse_regex(const char **s);
+
+static mpc_re_node_t *mpc_re_parse_base(const char **s) {
+
+  mpc_re_node_t *x;
+  const char *r;
+  char *body, *range;
+  int j;
+
+  switch (**s) {
+
+    case '(':
+      (*s)++;
+      x = mpc_re_parse_regex(s);
+      if (x == NULL || **s != ')') { mpc_re_node_delete(x); return NULL; }
+      (*s)++;
+      return x;
+
+    case '[':
+      r = *s + 1;
+      while (*r != ']') {
+        if (*r == '\0') { return NULL; }
+        if (*r == '\\' && r[1] == '\0') { return NULL; }
+        r += *r == '\\' ? 2 : 1;
+      }
+      if (r == *s + 1 || (r == *s + 2 && (*s)[1] == '^')) { return NULL; }
+
+      body = malloc(r - *s);
+      memcpy(body, *s + 1, r - *s - 1);
+      body[r - *s - 1] = '\0';
+      range = mpc_re_range_chars(body);
+
+      x = mpc_re_node_new(MPC_RE_SET);
+      for (j = 0; range[j]; j++) { MPC_RE_SET_ADD(x->set, range[j]); }
+      if (body[0] == '^') {
+        for (j = 0; j < 32; j++) { x->set[j] = (unsigned char)~x->set[j]; }
+        x->set[0] &= 0xFE;
+      } else {
+        MPC_RE_SET_ADD(x->set, '\0');
+      }
+
+      free(body);
+      free(range);
+      *s = r + 1;
+      return x;
+
+    case '\\':
+      (*s)++;
+      switch (*((*s)++)) {
+        case '\0': return NULL;
+        case 'a': return mpc_re_node_char('\a');
+        case 'f': return mpc_re_node_char('\f');
+        case 'n': return mpc_re_node_char('\n');
+        case 'r': return mpc_re_node_char('\r');
+        case 't': return mpc_re_node_char('\t');
+        case 'v': return mpc_re_node_char('\v');
+        case 'd': return mpc_re_node_oneof("0123456789");
+        case 's': return mpc_re_node_oneof(" \f\n\r\t\v");
+        case 'w':
+          x = mpc_re_node_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+          MPC_RE_SET_ADD(x->set, '_');
+          return x;
+        case 'b': case 'B': case 'A': case 'Z':
+        case 'D': case 'S': case 'W':
+          return NULL;
+        default: return mpc_re_node_char((*s)[-1]);
+      }
+
+    case '.':
+      (*s)++;
+      x = mpc_re_node_new(MPC_RE_SET);
+      memset(x->set, 0xFF, sizeof(x->set));
+      return x;
+
+    case '^':
+    case '$':
+      return NULL;
+
+    default:
+      (*s)++;
+      return mpc_re_node_char((*s)[-1]);
+  }
+}
+
+static mpc_re_node_t *mpc_re_parse_factor(const char **s) {
+
+  mpc_re_node_t *x, *y;
+  long num;
+  int j;
+  char *end;
+
+  x = mpc_re_parse_base(s);
+  if (x == NULL) { return NULL; }
+
+  switch (**s) {
+    case '*': (*s)++; return mpc_re_node_add(mpc_re_node_new(MPC_RE_MANY), x);
+    case '+': (*s)++; return mpc_re_node_add(mpc_re_node_new(MPC_RE_MANY1), x);
+    case '?': (*s)++; return mpc_re_node_add(mpc_re_node_new(MPC_RE_MAYBE), x);
+    case '{':
+      if (!isdigit((unsigned char)(*s)[1])) { mpc_re_node_delete(x); return NULL; }
+      num = strtol(*s + 1, &end, 10);
+      if (*end != '}' || num < 1 || num > MPC_RE_COUNT_MAX) { mpc_re_node_delete(x); return NULL; }
+      *s = end + 1;
+      y = mpc_re_node_new(MPC_RE_CAT);
+      for (j = 1; j < num; j++) { mpc_re_node_add(y, mpc_re_node_copy(x)); }
+      return mpc_re_node_add(y, x);
+    default: return x;
+  }
+}
+
+static mpc_re_node_t *mpc_re_parse_regex(const char **s) {
+
+  mpc_re_node_t *x, *y, *t = mpc_re_node_new(MPC_RE_CAT);
+
+  while (**s != '\0' && **s != ')' && **s != '|') {
+    y = mpc_re_parse_factor(s);
+    if (y == NULL) { mpc_re_node_delete(t); return NULL; }
+    mpc_re_node_add(t, y);
+  }
+
+  if (**s != '|') { return t; }
+
+  (*s)++;
+  y = mpc_re_parse_regex(s);
+  if (y == NULL) { mpc_re_node_delete(t); return NULL; }
+
+  x = mpc_re_node_add(mpc_re_node_new(MPC_RE_ALT), t);
+  if (y->type == MPC_RE_ALT) {
+    while (y->n) { mpc_re_node_add(x, y->xs[0]); memmove(y->xs, y->xs + 1, sizeof(mpc_re_node_t*) * --y->n); }
+    mpc_re_node_delete(y);
+  } else {
+    mpc_re_node_add(x, y);
+  }
+  return x;
+}
+
+static int mpc_re_nullable(mpc_re_node_t *x) {
+  int j;
+  switch (x->type) {
+    case MPC_RE_SET: return 0;
+    case MPC_RE_CAT:
+      for (j = 0; j < x->n; j++) { if (!mpc_re_nullable(x->xs[j])) { return 0; } }
+      return 1;
+    case MPC_RE_ALT:
+      for (j = 0; j < x->n; j++) { if (mpc_re_nullable(x->xs[j])) { return 1; } }
+      return 0;
+    case MPC_RE_MANY1: return mpc_re_nullable(x->xs[0]);
+    default: return 1;
+  }
+}
+
+static void mpc_re_first(mpc_re_node_t *x, unsigned char *set) {
+  int j;
+  switch (x->type) {
+    case MPC_RE_SET:
+      for (j = 0; j < 32; j++) { set[j] |= x->set[j]; }
+      break;
+    case MPC_RE_CAT:
+      for (j = 0; j < x->n; j++) {
+        mpc_re_first(x->xs[j], set);
+        if (!mpc_re_nullable(x->xs[j])) { break; }
+      }
+      break;
+    case MPC_RE_ALT:
+      for (j = 0; j < x->n; j++) { mpc_re_first(x->xs[j], set); }
+      break;
+    default:
+      mpc_re_first(x->xs[0], set);
+      break;
+  }
+}
+
+static int mpc_re_disjoint(const unsigned char *a, const unsigned char *b) {
+  int j;
+  for (j = 0; j < 32; j++) { if (a[j] & b[j]) { return 0; } }
+  return 1;
+}
+
+/*
+** Checks that the greedy, ordered combinators & the
+** longest match agree on `x` when followed by any of
+** the characters in `follow`.
+*/
+static int mpc_re_deterministic(mpc_re_node_t *x, const unsigned char *follow) {
+
+  unsigned char first[32], inner[32], seen[32];
+  int j, k;
+
+  switch (x->type) {
+
+    case MPC_RE_SET: return 1;
+
+    case MPC_RE_CAT:
+      memcpy(inner, follow, 32);
+      for (j = x->n - 1; j >= 0; j--) {
+        if (!mpc_re_deterministic(x->xs[j], inner)) { return 0; }
+        memset(first, 0, 32);
+        mpc_re_first(x->xs[j], first);
+        if (!mpc_re_nullable(x->xs[j])) { memset(inner, 0, 32); }
+        for (k = 0; k < 32; k++) { inner[k] |= first[k]; }
+      }
+      return 1;
+
+    case MPC_RE_ALT:
+      memset(seen, 0, 32);
+      for (j = 0; j < x->n; j++) {
+        if (mpc_re_nullable(x->xs[j])) { return 0; }
+        memset(first, 0, 32);
+        mpc_re_first(x->xs[j], first);
+        if (!mpc_re_disjoint(first, seen)) { return 0; }
+        for (k = 0; k < 32; k++) { seen[k] |= first[k]; }
+        if (!mpc_re_deterministic(x->xs[j], follow)) { return 0; }
+      }
+      return 1;
+
+    default:
+      if (mpc_re_nullable(x->xs[0])) { return 0; }
+      memset(first, 0, 32);
+      mpc_re_first(x->xs[0], first);
+      if (!mpc_re_disjoint(first, follow)) { return 0; }
+      memcpy(inner, follow, 32);
+      if (x->type != MPC_RE_MAYBE) {
+        for (k = 0; k < 32; k++) { inner[k] |= first[k]; }
+      }
+      return mpc_re_deterministic(x->xs[0], inner);
+  }
+}
+
+/*
+** Thompson NFA. Set states consume one character of
+** their set; epsilon states move on without input.
+*/
+
+enum {
+  MPC_NFA_SET   = 0,
+  MPC_NFA_EPS   = 1,
+  MPC_NFA_MATCH = 2
+};
+
+typedef struct {
+  int type;
+  const unsigned char *set;
+  int out[2];
+} mpc_nfa_state_t;
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_nfa_state_t *states;
+} mpc_nfa_t;
+
+static int mpc_nfa_add(mpc_nfa_t *a, int type, const unsigned char *set) {
+  if (a->num == a->slots) {
+    a->slots = a->slots ? a->slots * 2 : 32;
+    a->states = realloc(a->states, sizeof(mpc_nfa_state_t) * a->slots);
+  }
+  a->states[a->num].type = type;
+  a->states[a->num].set = set;
+  a->states[a->num].out[0] = -1;
+  a->states[a->num].out[1] = -1;
+  return a->num++;
+}
+
+static void mpc_nfa_build(mpc_nfa_t *a, mpc_re_node_t *x, int *start, int *end) {
+
+  int j, s, e, xs, xe, cur, next;
+
+  switch (x->type) {
+
+    case MPC_RE_SET:
+      s = mpc_nfa_add(a, MPC_NFA_SET, x->set);
+      e = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      a->states[s].out[0] = e;
+      break;
+
+    case MPC_RE_CAT:
+      s = e = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      for (j = 0; j < x->n; j++) {
+        mpc_nfa_build(a, x->xs[j], &xs, &xe);
+        a->states[e].out[0] = xs;
+        e = xe;
+      }
+      break;
+
+    case MPC_RE_ALT:
+      e = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      s = cur = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      for (j = 0; j < x->n; j++) {
+        mpc_nfa_build(a, x->xs[j], &xs, &xe);
+        a->states[xe].out[0] = e;
+        a->states[cur].out[0] = xs;
+        if (j < x->n - 1) {
+          next = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+          a->states[cur].out[1] = next;
+          cur = next;
+        }
+      }
+      break;
+
+    case MPC_RE_MANY:
+    case MPC_RE_MAYBE:
+      s = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      e = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      mpc_nfa_build(a, x->xs[0], &xs, &xe);
+      a->states[s].out[0] = xs;
+      a->states[s].out[1] = e;
+      a->states[xe].out[0] = x->type == MPC_RE_MANY ? s : e;
+      break;
+
+    default:
+      mpc_nfa_build(a, x->xs[0], &xs, &xe);
+      e = mpc_nfa_add(a, MPC_NFA_EPS, NULL);
+      a->states[xe].out[0] = xs;
+      a->states[xe].out[1] = e;
+      s = xs;
+      break;
+  }
+
+  *start = s;
+  *end = e;
+}
+
+static void mpc_nfa_closure(mpc_nfa_t *a, int s, unsigned char *bits) {
+  if (s < 0 || (bits[s >> 3] & (1 << (s & 7)))) { return; }
+  bits[s >> 3] |= (unsigned char)(1 << (s & 7));
+  if (a->states[s].type == MPC_NFA_EPS) {
+    mpc_nfa_closure(a, a->states[s].out[0], bits);
+    mpc_nfa_closure(a, a->states[s].out[1], bits);
+  }
+}
+
+static char *mpc_dfa_expected(const int *trans) {
+
+  char *out, *p;
+  int c, count = 0, none;
+
+  for (c = 0; c < 256; c++) { if (trans[c] >= 0) { count++; } }
+
+  if (count == 0) { return NULL; }
+  if (count == 256) {
+    out = malloc(strlen("any character") + 1);
+    strcpy(out, "any character");
+    return out;
+  }
+
+  /* Mostly full sets read better by what they leave out */
+  none = count > 128;
+  out = malloc(256 + 16);
+  p = out + sprintf(out, count == 1 ? "'" : none ? "none of '" : "one of '");
+  for (c = 1; c < 256; c++) {
+    if ((trans[c] < 0) == none) { *p++ = (char)c; }
+  }
+  strcpy(p, "'");
   return out;
 }
 
+static mpc_dfa_t *mpc_dfa_build(mpc_re_node_t *x) {
+
+  mpc_nfa_t a;
+  mpc_dfa_t *d;
+  unsigned char *sets, *next;
+  int start, end, match, bytes, num, slots, j, k, c, any;
+
+  a.num = 0;
+  a.slots = 0;
+  a.states = NULL;
+  mpc_nfa_build(&a, x, &start, &end);
+  match = mpc_nfa_add(&a, MPC_NFA_MATCH, NULL);
+  a.states[end].out[0] = match;
+
+  bytes = (a.num + 7) / 8;
+  slots = 8;
+  sets = calloc(slots, bytes);
+  next = malloc(bytes);
+
+  d = malloc(sizeof(mpc_dfa_t));
+  d->trans = malloc(sizeof(int) * 256 * slots);
+
+  num = 1;
+  mpc_nfa_closure(&a, start, sets);
+
+  /* Subset construction - each DFA state is a set of NFA states */
+  for (j = 0; j < num; j++) {
+    for (c = 0; c < 256; c++) {
+
+      memset(next, 0, bytes);
+      any = 0;
+      for (k = 0; k < a.num; k++) {
+        if (!(sets[j * bytes + (k >> 3)] & (1 << (k & 7)))) { continue; }
+        if (a.states[k].type != MPC_NFA_SET || !MPC_RE_SET_HAS(a.states[k].set, c)) { continue; }
+        mpc_nfa_closure(&a, a.states[k].out[0], next);
+        any = 1;
+      }
+
+      if (!any) { d->trans[j * 256 + c] = -1; continue; }
+
+      for (k = 0; k < num; k++) {
+        if (memcmp(sets + k * bytes, next, bytes) == 0) { break; }
+      }
+
+      if (k == num) {
+        if (num == MPC_DFA_STATES_MAX) {
+          free(a.states); free(sets); free(next); free(d->trans); free(d);
+          return NULL;
+        }
+        if (num == slots) {
+          slots *= 2;
+          sets = realloc(sets, slots * bytes);
+          d->trans = realloc(d->trans, sizeof(int) * 256 * slots);
+        }
+        memcpy(sets + num * bytes, next, bytes);
+        num++;
+      }
+
+      d->trans[j * 256 + c] = k;
+    }
+  }
+
+  d->states = num;
+  d->trans = realloc(d->trans, sizeof(int) * 256 * num);
+  d->accept = malloc(num);
+  d->expected = malloc(sizeof(char*) * num);
+  for (j = 0; j < num; j++) {
+    d->accept[j] = (sets[j * bytes + (match >> 3)] & (1 << (match & 7))) != 0;
+    d->expected[j] = mpc_dfa_expected(d->trans + j * 256);
+  }
+
+  free(a.states);
+  free(sets);
+  free(next);
+  return d;
+}
+
+/*
+** Returns a parser running `re` as a DFA, or NULL if
+** it must be left to the combinators.
+*/
+static mpc_parser_t *mpc_re_dfa(const char *re) {
+
+  mpc_parser_t *p;
+  mpc_re_node_t *x;
+  mpc_dfa_t *d;
+  unsigned char none[32];
+  const char *s = re;
+
+  x = mpc_re_parse_regex(&s);
+  if (x == NULL) { return NULL; }
+
+  memset(none, 0, 32);
+  if (*s != '\0' || !mpc_re_deterministic(x, none)) {
+    mpc_re_node_delete(x);
+    return NULL;
+  }
+
+  d = mpc_dfa_build(x);
+  mpc_re_node_delete(x);
+  if (d == NULL) { return NULL; }
+
+  d->re = malloc(strlen(re) + 1);
+  strcpy(d->re, re);
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -2163,6 +4854,10 @@ mpc_parser_t *mpc_re(const char *re) {
   mpc_result_t r;
   mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
   
+  /* Use a DFA where it matches exactly what the combinators would */
+  mpc_parser_t *dfa = mpc_re_dfa(re);
+  if (dfa) { return dfa; }
+  
   Regex  = mpc_new("regex");
   Term   = mpc_new("term");
   Factor = mpc_new("factor");
@@ -2503,6 +5198,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
+  if (p->type == MPC_TYPE_DFA) { printf("/%s/", p->data.dfa.x->re); }
 
   if (p->type == MPC_TYPE_SINGLE) {
     buff[0] = p->data.single.x; buff[1] = '\0';
@@ -2560,6 +5256,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_TOKEN)    { mpc_print_unretained(p->data.token.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2665,20 +5363,42 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+/*
+** Trees as deep as the parser can build are freed
+** with a stack of their own rather than recursion.
+*/
 void mpc_ast_delete(mpc_ast_t *a) {
   
-  int i;
+  int i, num, slots;
+  mpc_ast_t **stk;
   
   if (a == NULL) { return; }
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+  num = 0;
+  slots = 64;
+  stk = malloc(sizeof(mpc_ast_t*) * slots);
+  stk[num++] = a;
+  
+  while (num > 0) {
+    
+    a = stk[--num];
+    
+    if (num + a->children_num > slots) {
+      while (num + a->children_num > slots) { slots *= 2; }
+      stk = realloc(stk, sizeof(mpc_ast_t*) * slots);
+    }
+    
+    for (i = 0; i < a->children_num; i++) {
+      stk[num++] = a->children[i];
+    }
+    
+    free(a->children);
+    free(a->tag);
+    free(a->contents);
+    free(a);
   }
   
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  free(stk);
   
 }
 
@@ -2700,6 +5420,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   strcpy(a->contents, contents);
   
   a->state = mpc_state_new();
+  a->rules = 0;
   
   a->children_num = 0;
   a->children = NULL;
@@ -3011,6 +5732,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      as[i]->children[0]->rules |= as[i]->rules;
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
@@ -3056,6 +5778,8 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
   return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
 }
 
+unsigned long mpca_rule(mpc_parser_t *p) { return p->rule; }
+
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
@@ -3163,6 +5887,7 @@ typedef struct {
   int parsers_num;
   mpc_parser_t **parsers;
   int flags;
+  mpc_lexer_t *lexer;
 } mpca_grammar_st_t;
 
 static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
@@ -3193,10 +5918,94 @@ static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
   return mpca_count(num, xs[0]);
 }
 
+/*
+** The kind of token `a` matches, added to the lexer if
+** new, or -1 if it cannot be lexed. Kinds matching the
+** same text are one kind.
+*/
+static int mpca_lexer_kind(mpc_lexer_t *l, mpc_parser_t *a) {
+
+  int j;
+  char c[2];
+  const char *lit = NULL;
+  mpc_dfa_t *d = NULL;
+  mpc_lex_kind_t *x;
+
+  if (a->type == MPC_TYPE_EXPECT) { a = a->data.expect.x; }
+
+  switch (a->type) {
+    case MPC_TYPE_SINGLE: c[0] = a->data.single.x; c[1] = '\0'; lit = c; break;
+    case MPC_TYPE_STRING: lit = a->data.string.x; break;
+    case MPC_TYPE_DFA:    d = a->data.dfa.x; break;
+    default: return -1;
+  }
+
+  if (lit && lit[0] == '\0') { return -1; }
+  if (d && d->accept[0]) { return -1; }
+
+  for (j = 0; j < l->num; j++) {
+    x = &l->kinds[j];
+    if (lit && x->lit && strcmp(lit, x->lit) == 0) { return j; }
+    if (d && x->dfa && strcmp(d->re, x->dfa->re) == 0) { return j; }
+  }
+
+  if (l->num == (int)(sizeof(unsigned long) * CHAR_BIT)) { return -1; }
+
+  l->kinds = realloc(l->kinds, sizeof(mpc_lex_kind_t) * (l->num + 1));
+  x = &l->kinds[l->num];
+  x->lit = NULL;
+  x->len = 0;
+  x->dfa = NULL;
+  if (lit) {
+    x->len = (long)strlen(lit);
+    x->lit = malloc(x->len + 1);
+    strcpy(x->lit, lit);
+  } else {
+    x->dfa = mpc_dfa_copy(d);
+  }
+
+  return l->num++;
+}
+
+/* As `mpc_tok`, but matched against tokens when the grammar is tokenized */
+static mpc_parser_t *mpca_tok(mpca_grammar_st_t *st, mpc_parser_t *a) {
+
+  mpc_parser_t *p;
+  int kind;
+
+  if (!(st->flags & MPCA_LANG_TOKENIZE)) { return mpc_tok(a); }
+
+  if (st->lexer == NULL) {
+    st->lexer = malloc(sizeof(mpc_lexer_t));
+    st->lexer->num = 0;
+    st->lexer->kinds = NULL;
+    st->lexer->cands = NULL;
+    st->lexer->refs = 1;
+  }
+
+  kind = mpca_lexer_kind(st->lexer, a);
+  if (kind < 0) { return mpc_tok(a); }
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_TOKEN;
+  p->data.token.x = mpc_tok(a);
+  p->data.token.l = st->lexer;
+  p->data.token.kind = kind;
+  st->lexer->refs++;
+  return p;
+}
+
+/* Builds the lexer's tables once all its kinds are known, & drops the grammar's hold on it */
+static void mpca_lexer_done(mpca_grammar_st_t *st) {
+  if (st->lexer == NULL) { return; }
+  if (st->lexer->refs > 1) { mpc_lexer_ready(st->lexer); }
+  mpc_lexer_release(st->lexer);
+}
+
 static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpca_tok(st, mpc_string(y));
   free(y);
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
 }
@@ -3204,7 +6013,7 @@ static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
 static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpca_tok(st, mpc_char(y[0]));
   free(y);
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
 }
@@ -3212,7 +6021,7 @@ static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpca_tok(st, mpc_re(y));
   free(y);
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
 }
@@ -3224,6 +6033,18 @@ static int is_number(const char* s) {
   return 1;
 }
 
+/*
+** Each parser given to a grammar is a rule, & the nth
+** is bit n of the `rules` of the trees it builds, for
+** as many rules as there are bits.
+*/
+static void mpca_grammar_add_parser(mpca_grammar_st_t *st, mpc_parser_t *p) {
+  int n = st->parsers_num++;
+  st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+  st->parsers[n] = p;
+  if (p && n < (int)(sizeof(unsigned long) * CHAR_BIT)) { p->rule = 1UL << n; }
+}
+
 static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
   
   int i;
@@ -3235,9 +6056,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
     i = strtol(x, NULL, 10);
     
     while (st->parsers_num <= i) {
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
+      mpca_grammar_add_parser(st, va_arg(*st->va, mpc_parser_t*));
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
@@ -3259,10 +6078,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
     while (1) {
     
       p = va_arg(*st->va, mpc_parser_t*);
-      
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = p;
+      mpca_grammar_add_parser(st, p);
       
       if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
       if (p->name && strcmp(p->name, x) == 0) { return p; }
@@ -3277,13 +6093,26 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   
   mpca_grammar_st_t *st = s;
   mpc_parser_t *p = mpca_grammar_find_parser(x, st);
+  mpc_parser_t *ref;
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    ref = mpca_state(mpca_root(mpc_apply_to(p, mpcaf_ast_add_rule, p)));
   } else {
-    return mpca_state(mpca_root(p));
+    ref = mpca_state(mpca_root(p));
+  }
+  
+  /*
+  ** Every reference to a rule wraps it the same way, so
+  ** they can share entries keyed by the rule. Memoising
+  ** the wrapped result means a replayed tree is handed
+  ** back whole rather than tagged again.
+  */
+  if (st->flags & MPCA_LANG_PACKRAT) {
+    ref = mpc_memo_keyed(ref, (mpc_dtor_t)mpc_ast_delete, p);
   }
+  
+  return ref;
 }
 
 mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
@@ -3349,7 +6178,9 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_optimise(r.output);
   
-  return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
+  if (st->flags & MPCA_LANG_PREDICTIVE) { r.output = mpc_predictive(r.output); }
+  ((mpc_parser_t*)r.output)->arena = (st->flags & MPCA_LANG_ARENA) != 0;
+  return r.output;
   
 }
 
@@ -3363,8 +6194,10 @@ mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.lexer = NULL;
   
   res = mpca_grammar_st(grammar, &st);  
+  mpca_lexer_done(&st);
   free(st.parsers);
   va_end(va);
   return res;
@@ -3423,6 +6256,12 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
   mpca_stmt_t *stmt;
   mpca_stmt_t **stmts = x;
   mpc_parser_t *left;
+  mpc_parser_t **lefts;
+  int j, n = 0;
+  
+  while (stmts[n]) { n++; }
+  lefts = malloc(sizeof(mpc_parser_t*) * (n + 1));
+  n = 0;
 
   while(*stmts) {
     stmt = *stmts;
@@ -3431,12 +6270,18 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
+    left->arena = (st->flags & MPCA_LANG_ARENA) != 0;
+    lefts[n++] = left;
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
     stmts++;
   }
   
+  /* Dispatch tables can only see rules once all are defined */
+  for (j = 0; j < n; j++) { mpc_optimise(lefts[j]); }
+  
+  free(lefts);
   free(x);
   
   return NULL;
@@ -3523,9 +6368,11 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.lexer = NULL;
   
   i = mpc_input_new_file("<mpca_lang_file>", f);
   err = mpca_lang_st(i, &st);
+  mpca_lexer_done(&st);
   mpc_input_delete(i);
   
   free(st.parsers);
@@ -3545,9 +6392,11 @@ mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.lexer = NULL;
   
   i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
   err = mpca_lang_st(i, &st);
+  mpca_lexer_done(&st);
   mpc_input_delete(i);
   
   free(st.parsers);
@@ -3568,9 +6417,11 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.lexer = NULL;
   
   i = mpc_input_new_string("<mpca_lang>", language);
   err = mpca_lang_st(i, &st);
+  mpca_lexer_done(&st);
   mpc_input_delete(i);
   
   free(st.parsers);
@@ -3599,9 +6450,11 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.lexer = NULL;
   
   i = mpc_input_new_file(filename, f);
   err = mpca_lang_st(i, &st);
+  mpca_lexer_done(&st);
   mpc_input_delete(i);
   
   free(st.parsers);
@@ -3623,6 +6476,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_TOKEN)    { return 1 + mpc_nodecount_unretained(p->data.token.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3657,6 +6512,524 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
+/*
+** Profile Reports
+*/
+
+static const char *mpc_profile_types[] = {
+  "undefined", "pass", "fail", "lift", "lift_val", "expect", "anchor", "state",
+  "any", "char", "oneof", "noneof", "range", "satisfy", "string",
+  "apply", "apply_to", "predict", "not", "maybe", "many", "many1", "count",
+  "or", "and", "regex", "memo", "token"
+};
+
+static void mpc_profile_escaped(FILE *out, const char *fmt, const char *x) {
+  char *s = mpcf_escape_new((mpc_val_t*)x, mpc_escape_input_c, mpc_escape_output_c);
+  fprintf(out, fmt, s);
+  free(s);
+}
+
+/*
+** Named parsers are shown by name. Any other is shown
+** after the one it was first entered from, by its type,
+** its place among the children of an `or` or `and`, &
+** what it matches if it is a primitive.
+*/
+static void mpc_profile_label(mpc_profile_t *f, FILE *out, int j) {
+
+  mpc_parser_t *p = f->nodes[j].p;
+  mpc_parser_t *q;
+  char buff[2];
+  int k;
+
+  if (p->name) { fprintf(out, "<%s>", p->name); return; }
+
+  if (f->nodes[j].parent >= 0) {
+    mpc_profile_label(f, out, f->nodes[j].parent);
+    fputc(' ', out);
+  }
+
+  fputs(mpc_profile_types[(int)p->type], out);
+
+  q = f->nodes[j].parent >= 0 ? f->nodes[f->nodes[j].parent].p : NULL;
+  if (q && q->type == MPC_TYPE_OR) {
+    for (k = 0; k < q->data.or.n; k++) {
+      if (q->data.or.xs[k] == p) { fprintf(out, "#%i", k); break; }
+    }
+  }
+  if (q && q->type == MPC_TYPE_AND) {
+    for (k = 0; k < q->data.and.n; k++) {
+      if (q->data.and.xs[k] == p) { fprintf(out, "#%i", k); break; }
+    }
+  }
+
+  switch (p->type) {
+    case MPC_TYPE_SINGLE:
+      buff[0] = p->data.single.x; buff[1] = '\0';
+      mpc_profile_escaped(out, " '%s'", buff);
+      break;
+    case MPC_TYPE_STRING: mpc_profile_escaped(out, " \"%s\"", p->data.string.x); break;
+    case MPC_TYPE_ONEOF:  mpc_profile_escaped(out, " [%s]", p->data.string.x); break;
+    case MPC_TYPE_NONEOF: mpc_profile_escaped(out, " [^%s]", p->data.string.x); break;
+    case MPC_TYPE_DFA:    fprintf(out, " /%s/", p->data.dfa.x->re); break;
+    case MPC_TYPE_EXPECT: mpc_profile_escaped(out, " %s", p->data.expect.m); break;
+    default: break;
+  }
+}
+
+static int mpc_profile_cmp(const void *a, const void *b) {
+  const mpc_profile_node_t *x = *(mpc_profile_node_t* const*)a;
+  const mpc_profile_node_t *y = *(mpc_profile_node_t* const*)b;
+  if (x->self != y->self) { return x->self < y->self ? 1 : -1; }
+  return x < y ? -1 : x > y;
+}
+
+/* One row per parser, most time spent in itself first */
+void mpc_profile_print(mpc_profile_t *f, FILE *out) {
+
+  int j;
+  double ms = 1000.0 / MPC_PROFILE_CLOCKS_PER_SEC;
+  mpc_profile_node_t *n, **order = malloc(sizeof(mpc_profile_node_t*) * (f->nodes_num + 1));
+
+  for (j = 0; j < f->nodes_num; j++) { order[j] = &f->nodes[j]; }
+  qsort(order, f->nodes_num, sizeof(mpc_profile_node_t*), mpc_profile_cmp);
+
+  fprintf(out, "%10s %10s %10s %10s %12s %10s %10s  %s\n",
+    "calls", "ok", "failed", "rewinds", "bytes", "self ms", "total ms", "parser");
+
+  for (j = 0; j < f->nodes_num; j++) {
+    n = order[j];
+    fprintf(out, "%10lu %10lu %10lu %10lu %12lu %10.3f %10.3f  ",
+      n->calls, n->successes, n->failures, n->rewinds, n->bytes,
+      n->self * ms, n->total * ms);
+    mpc_profile_label(f, out, (int)(n - f->nodes));
+    fputc('\n', out);
+  }
+
+  free(order);
+}
+
+/*
+** Each line is a chain of rules joined by `;` & the
+** clock ticks spent under it outside any further rule,
+** which is the folded format read by flame graph tools.
+*/
+void mpc_profile_folded(mpc_profile_t *f, FILE *out) {
+
+  int j, k, depth, slots = 16;
+  int *chain = malloc(sizeof(int) * slots);
+
+  if (f->paths[0].self) { fprintf(out, "<anon> %lu\n", f->paths[0].self); }
+
+  for (j = 1; j < f->paths_num; j++) {
+
+    if (f->paths[j].self == 0) { continue; }
+
+    depth = 0;
+    for (k = j; k > 0; k = f->paths[k].parent) {
+      if (depth == slots) {
+        slots *= 2;
+        chain = realloc(chain, sizeof(int) * slots);
+      }
+      chain[depth++] = k;
+    }
+
+    while (depth--) {
+      fputs(f->paths[chain[depth]].p->name, out);
+      fputc(depth ? ';' : ' ', out);
+    }
+    fprintf(out, "%lu\n", f->paths[j].self);
+  }
+
+  free(chain);
+}
+
+/*
+** FIRST Sets
+**
+** What a parser can start with, whether it can match
+** nothing, & which expected strings it reports when
+** run at a byte it cannot start with. Rules are
+** followed through references, so left recursion & any
+** parser whose behaviour depends on more than the next
+** byte are left unknown & never skipped.
+*/
+
+enum { MPC_FIRST_DEPTH = 64 };
+
+typedef struct {
+  int known;
+  int nullable;
+  unsigned char first[32];
+  int expected_known;
+  int expected_num;
+  char **expected;
+} mpc_first_t;
+
+static void mpc_first_add(mpc_first_t *f, int b) {
+  f->first[b >> 3] |= 1 << (b & 7);
+}
+
+static void mpc_first_expect(mpc_first_t *f, char *x) {
+  f->expected_num++;
+  f->expected = realloc(f->expected, sizeof(char*) * f->expected_num);
+  f->expected[f->expected_num-1] = x;
+}
+
+static void mpc_first_unknown(mpc_first_t *f) {
+  f->known = 0;
+  f->expected_known = 0;
+}
+
+static void mpc_first(mpc_parser_t *p, mpc_first_t *f, mpc_parser_t **seen, int depth) {
+  
+  int j, b;
+  char c;
+  mpc_first_t g;
+  
+  f->known = 1;
+  f->nullable = 0;
+  memset(f->first, 0, sizeof(f->first));
+  f->expected_known = 1;
+  f->expected_num = 0;
+  f->expected = NULL;
+  
+  for (j = 0; j < depth; j++) {
+    if (seen[j] == p) { mpc_first_unknown(f); return; }
+  }
+  
+  if (depth == MPC_FIRST_DEPTH) { mpc_first_unknown(f); return; }
+  seen[depth] = p;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+      for (b = 0; b < 256; b++) { mpc_first_add(f, b); }
+    break;
+    
+    case MPC_TYPE_SINGLE:
+      mpc_first_add(f, (unsigned char)p->data.single.x);
+    break;
+    
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+      for (b = 0; b < 256; b++) {
+        c = (char)b;
+        if ((p->type == MPC_TYPE_RANGE   && c >= p->data.range.x && c <= p->data.range.y)
+        ||  (p->type == MPC_TYPE_ONEOF   && strchr(p->data.string.x, c) != 0)
+        ||  (p->type == MPC_TYPE_NONEOF  && strchr(p->data.string.x, c) == 0)
+        ||  (p->type == MPC_TYPE_SATISFY && p->data.satisfy.f(c))) {
+          mpc_first_add(f, b);
+        }
+      }
+    break;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0]) {
+        mpc_first_add(f, (unsigned char)p->data.string.x[0]);
+      } else {
+        f->nullable = 1;
+      }
+    break;
+    
+    case MPC_TYPE_DFA:
+      for (b = 0; b < 256; b++) {
+        if (p->data.dfa.x->trans[b] >= 0) { mpc_first_add(f, b); }
+      }
+      f->nullable = p->data.dfa.x->accept[0];
+      if (p->data.dfa.x->expected[0]) { mpc_first_expect(f, p->data.dfa.x->expected[0]); }
+    break;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+      f->nullable = 1;
+    break;
+    
+    /* Errors inside an `expect` are suppressed */
+    case MPC_TYPE_EXPECT:
+      mpc_first(p->data.expect.x, &g, seen, depth+1);
+      f->known = g.known;
+      f->nullable = g.nullable;
+      memcpy(f->first, g.first, sizeof(f->first));
+      if (!g.nullable) { mpc_first_expect(f, p->data.expect.m); }
+      free(g.expected);
+    break;
+    
+    case MPC_TYPE_APPLY:    mpc_first(p->data.apply.x, f, seen, depth+1); break;
+    case MPC_TYPE_APPLY_TO: mpc_first(p->data.apply_to.x, f, seen, depth+1); break;
+    case MPC_TYPE_PREDICT:  mpc_first(p->data.predict.x, f, seen, depth+1); break;
+    case MPC_TYPE_MEMO:     mpc_first(p->data.memo.x, f, seen, depth+1); break;
+    case MPC_TYPE_TOKEN:    mpc_first(p->data.token.x, f, seen, depth+1); break;
+    
+    case MPC_TYPE_MAYBE:
+      mpc_first(p->data.not.x, f, seen, depth+1);
+      f->nullable = 1;
+    break;
+    
+    case MPC_TYPE_MANY:
+      mpc_first(p->data.repeat.x, f, seen, depth+1);
+      f->nullable = 1;
+    break;
+    
+    /* These reword the errors of what they repeat */
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_first(p->data.repeat.x, f, seen, depth+1);
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n == 0) { f->nullable = 1; }
+      f->expected_known = 0;
+    break;
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { f->nullable = 1; }
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_first(p->data.or.xs[j], &g, seen, depth+1);
+        if (!g.known) { mpc_first_unknown(f); free(g.expected); break; }
+        for (b = 0; b < 32; b++) { f->first[b] |= g.first[b]; }
+        if (!f->nullable) {
+          for (b = 0; b < g.expected_num; b++) { mpc_first_expect(f, g.expected[b]); }
+          f->expected_known = f->expected_known && g.expected_known;
+        }
+        if (g.nullable) { f->nullable = 1; }
+        free(g.expected);
+      }
+    break;
+    
+    case MPC_TYPE_AND:
+      f->nullable = 1;
+      for (j = 0; j < p->data.and.n; j++) {
+        mpc_first(p->data.and.xs[j], &g, seen, depth+1);
+        if (!g.known) { mpc_first_unknown(f); free(g.expected); break; }
+        for (b = 0; b < 32; b++) { f->first[b] |= g.first[b]; }
+        for (b = 0; b < g.expected_num; b++) { mpc_first_expect(f, g.expected[b]); }
+        f->expected_known = f->expected_known && g.expected_known;
+        free(g.expected);
+        if (!g.nullable) { f->nullable = 0; break; }
+      }
+    break;
+    
+    /* Depend on more than the next byte */
+    default:
+      mpc_first_unknown(f);
+    break;
+  }
+  
+}
+
+/*
+** Whether a parser always succeeds, & if `empty` is
+** set, without consuming anything.
+*/
+static int mpc_trivial(mpc_parser_t *p, int empty) {
+  int j;
+  switch (p->type) {
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:    return 1;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MAYBE:    return !empty;
+    case MPC_TYPE_EXPECT:   return mpc_trivial(p->data.expect.x, empty);
+    case MPC_TYPE_APPLY:    return mpc_trivial(p->data.apply.x, empty);
+    case MPC_TYPE_APPLY_TO: return mpc_trivial(p->data.apply_to.x, empty);
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_trivial(p->data.and.xs[j], empty)) { return 0; }
+      }
+      return 1;
+    default: return 0;
+  }
+}
+
+/*
+** The string a parser matches when it succeeds exactly
+** where the input starts with it, or NULL. Such as the
+** `'c'` & `"str"` of an mpca grammar, along with the
+** whitespace & tagging around them.
+*/
+static char *mpc_literal(mpc_parser_t *p) {
+  
+  int j;
+  char *s = NULL, *t;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_SINGLE:
+      if (p->data.single.x == '\0') { return NULL; }
+      s = malloc(2);
+      s[0] = p->data.single.x;
+      s[1] = '\0';
+      return s;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return NULL; }
+      s = malloc(strlen(p->data.string.x) + 1);
+      strcpy(s, p->data.string.x);
+      return s;
+    
+    case MPC_TYPE_EXPECT:   return mpc_literal(p->data.expect.x);
+    case MPC_TYPE_APPLY:    return mpc_literal(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO: return mpc_literal(p->data.apply_to.x);
+    case MPC_TYPE_MEMO:     return mpc_literal(p->data.memo.x);
+    case MPC_TYPE_TOKEN:    return mpc_literal(p->data.token.x);
+    
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (s) {
+          if (!mpc_trivial(p->data.and.xs[j], 0)) { free(s); return NULL; }
+          continue;
+        }
+        t = mpc_literal(p->data.and.xs[j]);
+        if (t) { s = t; continue; }
+        if (!mpc_trivial(p->data.and.xs[j], 1)) { return NULL; }
+      }
+      return s;
+    
+    default: return NULL;
+  }
+  
+}
+
+static mpc_trie_t *mpc_trie_build(char **lits, int n) {
+  
+  int j, k, e, node, num = 1, slots = 16;
+  int *alt, *first, *next;
+  unsigned char *key;
+  const unsigned char *u;
+  mpc_trie_t *t;
+  
+  /* Built as first child & next sibling lists, then flattened */
+  alt = malloc(sizeof(int) * slots);
+  first = malloc(sizeof(int) * slots);
+  next = malloc(sizeof(int) * slots);
+  key = malloc(slots);
+  alt[0] = n; first[0] = -1; next[0] = -1; key[0] = 0;
+  
+  for (j = 0; j < n; j++) {
+    
+    if (lits[j] == NULL) { continue; }
+    
+    node = 0;
+    for (u = (const unsigned char*)lits[j]; *u; u++) {
+      
+      for (k = first[node]; k >= 0 && key[k] != *u; k = next[k]);
+      
+      if (k < 0) {
+        if (num == slots) {
+          slots *= 2;
+          alt = realloc(alt, sizeof(int) * slots);
+          first = realloc(first, sizeof(int) * slots);
+          next = realloc(next, sizeof(int) * slots);
+          key = realloc(key, slots);
+        }
+        k = num++;
+        alt[k] = n; first[k] = -1; key[k] = *u;
+        next[k] = first[node];
+        first[node] = k;
+      }
+      
+      node = k;
+    }
+    
+    if (alt[node] == n) { alt[node] = j; }
+  }
+  
+  t = malloc(sizeof(mpc_trie_t));
+  t->num = num;
+  t->alt = alt;
+  t->edges = malloc(sizeof(int) * (num + 1));
+  t->keys = malloc(num);
+  t->kids = malloc(sizeof(int) * num);
+  
+  e = 0;
+  for (node = 0; node < num; node++) {
+    t->edges[node] = e;
+    for (k = first[node]; k >= 0; k = next[k]) {
+      /* Insertion sort by key */
+      for (j = e; j > t->edges[node] && t->keys[j-1] > key[k]; j--) {
+        t->keys[j] = t->keys[j-1];
+        t->kids[j] = t->kids[j-1];
+      }
+      t->keys[j] = key[k];
+      t->kids[j] = k;
+      e++;
+    }
+  }
+  t->edges[num] = e;
+  
+  free(first);
+  free(next);
+  free(key);
+  return t;
+}
+
+/*
+** Alternatives are only skipped for bytes they cannot
+** start with when they cannot match nothing & their
+** errors are known. The end of input & a literal `\0`
+** look the same, so every alternative is tried there.
+*/
+static void mpc_dispatch_build(mpc_parser_t *p) {
+  
+  int j, k, b, any = 0, lits_num = 0, n = p->data.or.n;
+  mpc_parser_t *seen[MPC_FIRST_DEPTH];
+  mpc_dispatch_t *d;
+  mpc_first_t f;
+  char **lits;
+  
+  if (n == 0) { return; }
+  
+  d = malloc(sizeof(mpc_dispatch_t));
+  d->skip = calloc(n, sizeof(*d->skip));
+  d->expected_num = calloc(n, sizeof(int));
+  d->expected = calloc(n, sizeof(char**));
+  d->literal = calloc(n, 1);
+  d->others = malloc(sizeof(int) * n);
+  d->others_num = 0;
+  d->trie = NULL;
+  lits = calloc(n, sizeof(char*));
+  
+  for (j = 0; j < n; j++) {
+    
+    mpc_first(p->data.or.xs[j], &f, seen, 0);
+    
+    if (f.known && f.expected_known && !f.nullable) {
+      for (b = 1; b < 256; b++) {
+        if (f.first[b >> 3] & (1 << (b & 7))) { continue; }
+        d->skip[j][b >> 3] |= 1 << (b & 7);
+        any = 1;
+      }
+      d->expected_num[j] = f.expected_num;
+      d->expected[j] = malloc(sizeof(char*) * f.expected_num);
+      for (k = 0; k < f.expected_num; k++) {
+        d->expected[j][k] = malloc(strlen(f.expected[k]) + 1);
+        strcpy(d->expected[j][k], f.expected[k]);
+      }
+      lits[j] = mpc_literal(p->data.or.xs[j]);
+    }
+    
+    free(f.expected);
+    
+    if (lits[j]) {
+      d->literal[j] = 1;
+      lits_num++;
+    } else {
+      d->others[d->others_num++] = j;
+    }
+  }
+  
+  if (lits_num > 1) { d->trie = mpc_trie_build(lits, n); }
+  
+  for (j = 0; j < n; j++) { free(lits[j]); }
+  free(lits);
+  
+  if (!any && !d->trie) { mpc_dispatch_delete(d, n); return; }
+  p->data.or.d = d;
+}
+
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
   int i, n, m;
@@ -3670,6 +7043,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_optimise_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_TOKEN)    { mpc_optimise_unretained(p->data.token.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3690,6 +7065,11 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
   /* Perform optimisations */
   
+  if (p->type == MPC_TYPE_OR) {
+    mpc_dispatch_delete(p->data.or.d, p->data.or.n);
+    p->data.or.d = NULL;
+  }
+  
   while (1) {
     
     /* Merge rhs `or` */
@@ -3698,6 +7078,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     && !p->data.or.xs[p->data.or.n-1]->retained) {
       t = p->data.or.xs[p->data.or.n-1];
       n = p->data.or.n; m = t->data.or.n;
+      mpc_dispatch_delete(t->data.or.d, m);
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
@@ -3711,6 +7092,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     && !p->data.or.xs[0]->retained) {
       t = p->data.or.xs[0];
       n = p->data.or.n; m = t->data.or.n;
+      mpc_dispatch_delete(t->data.or.d, m);
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
@@ -3818,10 +7200,12 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
-    return;
+    break;
     
   }
   
+  if (p->type == MPC_TYPE_OR) { mpc_dispatch_build(p); }
+  
 }
 
 void mpc_optimise(mpc_parser_t *p) {
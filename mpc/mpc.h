@@ -56,9 +56,19 @@ void mpc_err_print_to(mpc_err_t *e, FILE *f);
 
 typedef void mpc_val_t;
 
-typedef union {
+/*
+** A tree parsed by a grammar built with `MPCA_LANG_ARENA`
+** lives in `arena` & is freed with `mpc_arena_delete`
+** rather than `mpc_ast_delete`. Otherwise it is NULL.
+*/
+
+struct mpc_arena_t;
+typedef struct mpc_arena_t mpc_arena_t;
+
+typedef struct {
   mpc_err_t *error;
   mpc_val_t *output;
+  mpc_arena_t *arena;
 } mpc_result_t;
 
 struct mpc_parser_t;
@@ -68,8 +78,15 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_pipe_each(const char *filename, FILE *pipe, mpc_parser_t *p,
+  int (*f)(mpc_val_t*, void*), void *data, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+void mpc_arena_delete(mpc_arena_t *a);
+
+void mpc_mem_stats(unsigned long *hits, unsigned long *fallbacks);
+void mpc_memo_stats(unsigned long *hits, unsigned long *misses);
+
 /*
 ** Function Types
 */
@@ -140,6 +157,14 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** Packrat parsing: remembers how `a` went at each
+** position it is tried & replays that on later tries
+** instead of parsing again. `d` frees results that
+** are remembered but never used.
+*/
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_dtor_t d);
+
 /*
 ** Common Parsers
 */
@@ -261,8 +286,16 @@ mpc_parser_t *mpc_re(const char *re);
 ** AST
 */
 
+/*
+** Besides its tag, a tree built by a grammar has the
+** bit of each rule it matched set in `rules`, so its
+** kind can be told without reading the tag. See
+** `mpca_rule` for the bit of a rule.
+*/
+
 typedef struct mpc_ast_t {
   char *tag;
+  unsigned long rules;
   char *contents;
   mpc_state_t state;
   int children_num;
@@ -334,7 +367,10 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4,
+  MPCA_LANG_ARENA                = 8,
+  MPCA_LANG_TOKENIZE             = 16
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -344,6 +380,57 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
+/* The nth rule given to a grammar has bit n, or 0 if n is too large */
+unsigned long mpca_rule(mpc_parser_t *p);
+
+/*
+** Rule Events
+**
+** Instead of building a tree, a parse from one of the
+** rules of a grammar can call `f` for each named rule
+** matched, with its `bit` (see `mpca_rule`), the span
+** `[start, end)` it covers & `text` pointing at its
+** start. Rules arrive in the order they finish, so
+** children come before parents & the rule parsed from
+** is last. A span takes in any whitespace skipped
+** after it. No event comes from a match that was
+** later backtracked over. Each one is sent once only
+** a failure of the whole parse could undo it, so a
+** parse that fails may have sent some.
+*/
+
+typedef void(*mpca_event_t)(const char *rule, unsigned long bit, long start, long end, const char *text, void *data);
+
+int mpca_parse_events(const char *filename, const char *string, mpc_parser_t *p, mpca_event_t f, void *data, mpc_result_t *r);
+int mpca_parse_contents_events(const char *filename, mpc_parser_t *p, mpca_event_t f, void *data, mpc_result_t *r);
+
+/*
+** Profiling
+**
+** A parse given a profile counts, for each parser it
+** enters, the calls made, how many succeed & fail, how
+** often input is given back, the bytes matched & the
+** time spent. A profile builds up over many parses &
+** names the parsers it saw, so it must be reported on
+** before they are deleted.
+**
+** `mpc_profile_print` writes a table, one parser a
+** row. `mpc_profile_folded` writes the time spent
+** under each chain of named rules as folded stacks,
+** ready to be drawn as a flame graph.
+*/
+
+typedef struct mpc_profile_t mpc_profile_t;
+
+mpc_profile_t *mpc_profile_new(void);
+void mpc_profile_delete(mpc_profile_t *f);
+
+int mpc_parse_profile(const char *filename, const char *string, mpc_parser_t *p, mpc_profile_t *prof, mpc_result_t *r);
+int mpc_parse_contents_profile(const char *filename, mpc_parser_t *p, mpc_profile_t *prof, mpc_result_t *r);
+
+void mpc_profile_print(mpc_profile_t *f, FILE *out);
+void mpc_profile_folded(mpc_profile_t *f, FILE *out);
+
 /*
 ** Misc
 */
@@ -0,0 +1,296 @@
+#include <sched.h>
+#include <stdlib.h>
+#include "pool.h"
+
+#define POOL_DEQUE_MIN 64
+
+/**
+ * pool_self
+ * The deque owned by the calling thread, or 0 if it is not a pool worker.
+ */
+static __thread pool* pool_self_pool = NULL;
+static __thread int pool_self_id = 0;
+
+typedef struct {
+  pool* p;
+  int id;
+} pool_worker_arg;
+
+/*******************************************************************************
+ * deque_push
+ * Pushes a task onto the bottom of a deque, growing it as needed.
+ */
+static void deque_push(pool_deque* d, pool_task* t) {
+
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom - d->top == d->slots) {
+    pool_task** tasks = malloc(sizeof(pool_task*) * d->slots * 2);
+    for (int i = d->top; i < d->bottom; i++) {
+      tasks[i % (d->slots * 2)] = d->tasks[i % d->slots];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->slots *= 2;
+  }
+
+  d->tasks[d->bottom % d->slots] = t;
+  d->bottom++;
+
+  pthread_mutex_unlock(&d->lock);
+}
+
+
+
+/*******************************************************************************
+ * deque_pop
+ * Takes the most recently pushed task, or NULL if the deque is empty.
+ */
+static pool_task* deque_pop(pool_deque* d) {
+  pool_task* t = NULL;
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom > d->top) {
+    d->bottom--;
+    t = d->tasks[d->bottom % d->slots];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return t;
+}
+
+
+
+/*******************************************************************************
+ * deque_steal
+ * Takes the oldest task - usually the largest piece of work - or NULL.
+ */
+static pool_task* deque_steal(pool_deque* d) {
+  pool_task* t = NULL;
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom > d->top) {
+    t = d->tasks[d->top % d->slots];
+    d->top++;
+    // Keep the indices bounded: moving both back by `slots` keeps every task
+    // in its slot, & `bottom` never gets more than `slots` past `top`
+    if (d->top >= d->slots) {
+      d->top -= d->slots;
+      d->bottom -= d->slots;
+    }
+  }
+  pthread_mutex_unlock(&d->lock);
+  return t;
+}
+
+
+
+/*******************************************************************************
+ * pool_take
+ * Finds a task for deque `id` to run: its own newest task first, otherwise
+ * the oldest task of another deque.
+ */
+static pool_task* pool_take(pool* p, int id) {
+
+  if (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0) { return NULL; }
+
+  pool_task* t = deque_pop(&p->deques[id]);
+
+  for (int i = 1; t == NULL && i <= p->threads; i++) {
+    t = deque_steal(&p->deques[(id + i) % (p->threads + 1)]);
+  }
+
+  if (t) { __atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL); }
+  return t;
+}
+
+
+
+static void pool_run(pool_task* t) {
+  t->fn(t->arg);
+  if (t->detached) {
+    free(t);
+  } else {
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+  }
+}
+
+
+
+/*******************************************************************************
+ * pool_worker
+ * Worker thread main loop. Sleeps only when no deque holds any task.
+ */
+static void* pool_worker(void* x) {
+
+  pool_worker_arg* w = x;
+  pool* p = w->p;
+  pool_self_pool = p;
+  pool_self_id = w->id;
+
+  while (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+
+    pool_task* t = pool_take(p, pool_self_id);
+    if (t) {
+      pool_run(t);
+      continue;
+    }
+
+    pthread_mutex_lock(&p->idle_lock);
+    while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0 && !p->stop) {
+      pthread_cond_wait(&p->idle, &p->idle_lock);
+    }
+    pthread_mutex_unlock(&p->idle_lock);
+  }
+
+  free(w);
+  return NULL;
+}
+
+
+
+/*******************************************************************************
+ * pool_new
+ * Starts a work-stealing pool.
+ *
+ * @param threads - Number of worker threads. Threads calling `pool_wait` also
+ *        run tasks while they wait.
+ *
+ * @return - Pointer to the new pool.
+ */
+pool* pool_new(int threads) {
+
+  pool* p = malloc(sizeof(pool));
+  p->threads = threads;
+  p->pending = 0;
+  p->stop = 0;
+  pthread_mutex_init(&p->idle_lock, NULL);
+  pthread_cond_init(&p->idle, NULL);
+
+  p->deques = malloc(sizeof(pool_deque) * (threads + 1));
+  for (int i = 0; i <= threads; i++) {
+    pthread_mutex_init(&p->deques[i].lock, NULL);
+    p->deques[i].slots = POOL_DEQUE_MIN;
+    p->deques[i].tasks = malloc(sizeof(pool_task*) * POOL_DEQUE_MIN);
+    p->deques[i].top = 0;
+    p->deques[i].bottom = 0;
+  }
+
+  p->workers = malloc(sizeof(pthread_t) * threads);
+  for (int i = 0; i < threads; i++) {
+    pool_worker_arg* w = malloc(sizeof(pool_worker_arg));
+    w->p = p;
+    w->id = i + 1;
+    pthread_create(&p->workers[i], NULL, pool_worker, w);
+  }
+
+  return p;
+}
+
+
+
+/*******************************************************************************
+ * pool_del
+ * Stops all workers & frees the pool. No task may still be waited for.
+ *
+ * @desc Tasks still queued are run first, so detached tasks always get to
+ * release what they hold.
+ */
+void pool_del(pool* p) {
+
+  pool_task* t;
+  while ((t = pool_take(p, 0))) { pool_run(t); }
+
+  pthread_mutex_lock(&p->idle_lock);
+  __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&p->idle);
+  pthread_mutex_unlock(&p->idle_lock);
+
+  for (int i = 0; i < p->threads; i++) {
+    pthread_join(p->workers[i], NULL);
+  }
+
+  for (int i = 0; i <= p->threads; i++) {
+    pthread_mutex_destroy(&p->deques[i].lock);
+    free(p->deques[i].tasks);
+  }
+
+  pthread_mutex_destroy(&p->idle_lock);
+  pthread_cond_destroy(&p->idle);
+  free(p->deques);
+  free(p->workers);
+  free(p);
+}
+
+
+
+/*******************************************************************************
+ * pool_push
+ * Queues a task on the calling thread's deque & wakes an idle worker.
+ */
+static void pool_push(pool* p, pool_task* t) {
+
+  int id = (pool_self_pool == p) ? pool_self_id : 0;
+
+  deque_push(&p->deques[id], t);
+
+  pthread_mutex_lock(&p->idle_lock);
+  __atomic_add_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+  pthread_cond_signal(&p->idle);
+  pthread_mutex_unlock(&p->idle_lock);
+}
+
+
+
+/*******************************************************************************
+ * pool_submit
+ * Queues a task that can later be waited for with `pool_wait`.
+ *
+ * @param p - Pointer to the pool.
+ * @param t - Pointer to the task. `fn` & `arg` must be set.
+ */
+void pool_submit(pool* p, pool_task* t) {
+  t->done = 0;
+  t->detached = 0;
+  pool_push(p, t);
+}
+
+
+
+/*******************************************************************************
+ * pool_wait
+ * Blocks until given task has run, running other tasks in the meantime.
+ *
+ * @desc Helping rather than sleeping means nested waits cannot deadlock the
+ * pool: in the worst case the waiter runs its own task.
+ */
+void pool_wait(pool* p, pool_task* t) {
+
+  int id = (pool_self_pool == p) ? pool_self_id : 0;
+
+  while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+    pool_task* other = pool_take(p, id);
+    if (other) {
+      pool_run(other);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+
+
+/*******************************************************************************
+ * pool_spawn
+ * Queues a fire-and-forget task. Nothing can wait for it: the task must signal
+ * its own completion if anyone needs to know.
+ *
+ * @param p - Pointer to the pool.
+ * @param fn - Function to run.
+ * @param arg - Argument to pass to `fn`.
+ */
+void pool_spawn(pool* p, void (*fn)(void*), void* arg) {
+  pool_task* t = malloc(sizeof(pool_task));
+  t->fn = fn;
+  t->arg = arg;
+  t->done = 0;
+  t->detached = 1;
+  pool_push(p, t);
+}
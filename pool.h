@@ -0,0 +1,53 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+/**
+ * pool_task
+ * A unit of work. Owned by the submitter, which must keep it alive until
+ * `pool_wait` returns for it - unless it was started with `pool_spawn`, in
+ * which case the pool frees it after it runs.
+ */
+typedef struct pool_task {
+  void (*fn)(void* arg);
+  void* arg;
+  int done;
+  int detached;
+} pool_task;
+
+/**
+ * pool_deque
+ * Per-worker double-ended task queue. The owner pushes & pops at the bottom,
+ * thieves steal from the top.
+ */
+typedef struct pool_deque {
+  pthread_mutex_t lock;
+  pool_task** tasks;
+  int slots;
+  int top;
+  int bottom;
+} pool_deque;
+
+/**
+ * pool
+ * Work-stealing thread pool. Deque 0 is shared by all threads that are not
+ * workers of the pool; workers own deques 1..threads.
+ */
+typedef struct pool {
+  int threads;
+  pthread_t* workers;
+  pool_deque* deques;
+  int pending;
+  int stop;
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle;
+} pool;
+
+pool* pool_new(int threads);
+void pool_del(pool* p);
+void pool_submit(pool* p, pool_task* t);
+void pool_wait(pool* p, pool_task* t);
+void pool_spawn(pool* p, void (*fn)(void*), void* arg);
+
+#endif
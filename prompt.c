@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mpc/mpc.h"
 #include "utils.h"
 #include "lvals.h"
 #include "builtins.h"
+#include "context.h"
 
 #ifdef _WIN32
 
@@ -26,27 +28,55 @@ void add_history(char * unused) {}
 #include <editline/readline.h>
 #endif
 
+void print_result(lispy_ctx* ctx, lval* x, void* unused) {
+  lval* result = lval_eval(ctx, x);
+  lval_println(result);
+  lval_del(result);
+}
+
 int main(int argc, char ** argv) {
 
-  mpc_parser_t * Number = mpc_new("number");
-  mpc_parser_t * Symbol = mpc_new("symbol");
-  mpc_parser_t * Expr = mpc_new("expr");
-  mpc_parser_t * Sexpr = mpc_new("sexpr");
-  mpc_parser_t * Qexpr = mpc_new("qexpr");
-  mpc_parser_t * Lispy = mpc_new("lispy");
-
-  mpca_lang(MPCA_LANG_DEFAULT,
-    " number : /-?[0-9]+(\\.[0-9]+)?/;                               \
-      symbol : '+' | '-' | '*' | '/' | '%' | '^' | /m((in)|(ax))/    \
-             | \"head\" | \"tail\" | \"list\" | \"eval\" | \"init\"  \
-             | \"cons\" | \"len\";                                   \
-      expr   : <number> | <symbol> | <sexpr> | <qexpr>;              \
-      sexpr  : '(' <expr>* ')';                                      \
-      qexpr  : '{' <expr>* '}';                                      \
-      lispy  : /^/ <expr>* /$/;                                      \
-    ",
-    Number, Symbol, Expr, Sexpr, Qexpr, Lispy
-  );
+  lispy_ctx* ctx = lispy_ctx_new();
+
+  // Parse options: `-j <threads>` enables parallel evaluation of expensive
+  // arguments, `-s <cost>` sets how expensive an argument must be to split,
+  // `-c <elements>` sets the chunk size of `pmap`, `pfilter` & `preduce`,
+  // `-r hand` reads input with the single-pass reader instead of mpc,
+  // `-f <file>` evaluates the expressions of a file before the REPL starts,
+  // `-f -` evaluates expressions from standard input as they arrive
+  int threads = 1;
+  int split_cost = LVAL_SPLIT_COST;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-j") == 0) { threads = atoi(argv[i + 1]); }
+    if (strcmp(argv[i], "-s") == 0) { split_cost = atoi(argv[i + 1]); }
+    if (strcmp(argv[i], "-c") == 0) { lispy_ctx_map_chunk(ctx, atoi(argv[i + 1])); }
+    if (strcmp(argv[i], "-r") == 0) { ctx->hand_reader = strcmp(argv[i + 1], "hand") == 0; }
+  }
+  lispy_ctx_parallel(ctx, threads, split_cost);
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-f") != 0) { continue; }
+
+    char* err;
+    if (strcmp(argv[i + 1], "-") == 0) {
+      if (!lispy_read_each(ctx, "<stdin>", stdin, print_result, NULL, &err)) {
+        fputs(err, stdout);
+        free(err);
+      }
+      continue;
+    }
+
+    lval* x = lispy_read_file(ctx, argv[i + 1], &err);
+    if (!x) {
+      fputs(err, stdout);
+      free(err);
+      continue;
+    }
+
+    // Evaluate & print each top-level expression in turn
+    while (x->count) { print_result(ctx, lval_pop(x, 0), NULL); }
+    lval_del(x);
+  }
 
   puts("Lispy Version 0.0.0.0.1");
   puts("Press Ctrl+C to exit");
@@ -56,23 +86,23 @@ int main(int argc, char ** argv) {
     add_history(input);
 
     // Parse user input
-    mpc_result_t r;
+    char* err;
+    lval* x = lispy_read(ctx, "<stdin>", input, &err);
 
-    if (mpc_parse("<stdin>", input, Lispy, &r)) {
+    if (x) {
       // Evaluate input and print result
-      lval* result = lval_eval(lval_read(r.output));
+      lval* result = lval_eval(ctx, x);
       lval_println(result);
       lval_del(result);
-      mpc_ast_delete(r.output);
     } else {
       // Error encountered
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+      fputs(err, stdout);
+      free(err);
     }
 
     free(input);
   }
 
-  mpc_cleanup(6, Number, Symbol, Expr, Sexpr, Qexpr, Lispy);
+  lispy_ctx_del(ctx);
   return 0;
 }
@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include "reader.h"
+#include "context.h"
+
+/**
+ * reader
+ * State of a single pass over a source buffer.
+ */
+typedef struct {
+  lispy_ctx* ctx;
+  const char* src;
+  const char* pos;
+  const char* end;
+  const char* err_pos;
+  char err_close;
+} reader;
+
+/*******************************************************************************
+ * reader_at
+ * Returns the character `k` places ahead, or '\0' past the end of input. The
+ * source need not be NUL-terminated.
+ */
+static char reader_at(reader* r, long k) {
+  return r->pos + k < r->end ? r->pos[k] : '\0';
+}
+
+
+
+/*******************************************************************************
+ * reader_space
+ * Skips the same whitespace mpc's tokens do.
+ */
+static void reader_space(reader* r) {
+  char c = reader_at(r, 0);
+  while (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+    r->pos++;
+    c = reader_at(r, 0);
+  }
+}
+
+
+
+/*******************************************************************************
+ * reader_match
+ * Finds the longest name of given table the input continues with.
+ *
+ * @param r - Pointer to the reader.
+ * @param names - NULL-terminated table of names.
+ * @param best - Pointer to the best match so far, updated if a longer name is
+ *        found.
+ * @param len - Length of `best`, updated along with it.
+ */
+static void reader_match(reader* r, char** names, char** best, size_t* len) {
+  for (int i = 0; names[i] != NULL; i++) {
+    if (names[i][0] != reader_at(r, 0)) { continue; }
+    size_t n = strlen(names[i]);
+    if (n > *len && n <= (size_t)(r->end - r->pos) && strncmp(r->pos, names[i], n) == 0) {
+      *best = names[i];
+      *len = n;
+    }
+  }
+}
+
+
+
+/*******************************************************************************
+ * reader_number
+ * Reads a number matching `-?[0-9]+(\.[0-9]+)?` as `lval_read` would.
+ *
+ * @return - Pointer to the number, or NULL if a `.` is not followed by a digit.
+ *         mpc's regex takes the `.` first, so the error is after it.
+ */
+static lval* reader_number(reader* r) {
+
+  const char* start = r->pos;
+  int neg = reader_at(r, 0) == '-';
+  if (neg) { r->pos++; }
+
+  // Accumulate towards the sign so that LONG_MIN is readable
+  value v;
+  v.num = 0;
+  int overflow = 0;
+  while (reader_at(r, 0) >= '0' && reader_at(r, 0) <= '9') {
+    long digit = *r->pos - '0';
+    overflow = overflow || __builtin_mul_overflow(v.num, 10, &v.num)
+      || __builtin_add_overflow(v.num, neg ? -digit : digit, &v.num);
+    r->pos++;
+  }
+  size_t len = r->pos - start;
+
+  // A fraction is read & ignored
+  if (reader_at(r, 0) == '.') {
+    r->pos++;
+    if (reader_at(r, 0) < '0' || reader_at(r, 0) > '9') {
+      r->err_pos = r->pos;
+      return NULL;
+    }
+    while (reader_at(r, 0) >= '0' && reader_at(r, 0) <= '9') { r->pos++; }
+  }
+
+  if (!overflow) { return make_lval(LVAL_NUM, v); }
+
+  // Too large for a fixnum, read as a bignum
+  v.big = big_from_str(start, len);
+  return make_lval(LVAL_BIG, v);
+}
+
+
+
+static lval* reader_list(reader* r, int type, char close);
+
+/*******************************************************************************
+ * reader_expr
+ * Reads one expression starting at the current, non-whitespace, position.
+ *
+ * @param r - Pointer to the reader.
+ * @param close - Delimiter closing the enclosing expression, or '\0' at the
+ *        top level. Used to describe what was expected on error.
+ *
+ * @return - Pointer to the expression, or NULL if none starts here.
+ */
+static lval* reader_expr(reader* r, char close) {
+
+  char c = reader_at(r, 0);
+
+  if (c == '(') {
+    r->pos++;
+    return reader_list(r, LVAL_SEXPR, ')');
+  }
+  if (c == '{') {
+    r->pos++;
+    return reader_list(r, LVAL_QEXPR, '}');
+  }
+  if ((c >= '0' && c <= '9') || (c == '-' && reader_at(r, 1) >= '0' && reader_at(r, 1) <= '9')) {
+    lval* x = reader_number(r);
+    if (!x) { r->err_close = close; }
+    return x;
+  }
+
+  // Symbols need no delimiter after them, so take the longest known name. The
+  // table entry itself becomes the symbol's string, so nothing is copied
+  char* name = NULL;
+  size_t len = 0;
+  reader_match(r, operator_names, &name, &len);
+  reader_match(r, r->ctx->builtin_names, &name, &len);
+  reader_match(r, r->ctx->special_names, &name, &len);
+
+  if (name) {
+    r->pos += len;
+    value v;
+    v.sym = name;
+    return make_lval(LVAL_SYM, v);
+  }
+
+  // mpc reports a regex that stops part way, as `m` does short of `min` or
+  // `max`, after the characters it matched. Quoted names fail at their start
+  size_t prefix = 0;
+  for (int i = 0; operator_names[i] != NULL; i++) {
+    size_t n = 0;
+    while (operator_names[i][n] != '\0' && operator_names[i][n] == reader_at(r, n)) { n++; }
+    prefix = n > prefix ? n : prefix;
+  }
+
+  r->err_pos = r->pos + prefix;
+  r->err_close = close;
+  return NULL;
+}
+
+
+
+/*******************************************************************************
+ * reader_list
+ * Reads expressions up to & including the closing delimiter.
+ *
+ * @param r - Pointer to the reader.
+ * @param type - `LVAL_SEXPR` or `LVAL_QEXPR`.
+ * @param close - The closing delimiter, or '\0' to read to the end of input.
+ *
+ * @return - Pointer to the expression, or NULL on error.
+ */
+static lval* reader_list(reader* r, int type, char close) {
+
+  lval** cells = NULL;
+  int count = 0;
+  int slots = 0;
+
+  while (1) {
+    reader_space(r);
+    if (reader_at(r, 0) == close) { break; }
+
+    lval* x = reader_expr(r, close);
+    if (!x) {
+      for (int i = 0; i < count; i++) { lval_del(cells[i]); }
+      free(cells);
+      return NULL;
+    }
+
+    if (count == slots) {
+      slots = slots ? slots * 2 : 4;
+      cells = realloc(cells, sizeof(lval*) * slots);
+    }
+    cells[count++] = x;
+  }
+
+  if (close) { r->pos++; }
+  return lval_expr(type, cells, count);
+}
+
+
+
+/*******************************************************************************
+ * reader_error
+ * Describes a read error in the same format & position as mpc.
+ */
+static char* reader_error(reader* r, const char* filename) {
+
+  int row = 1;
+  int col = 1;
+  for (const char* p = r->src; p < r->err_pos; p++) {
+    if (*p == '\n') {
+      row++;
+      col = 1;
+    } else {
+      col++;
+    }
+  }
+
+  r->pos = r->err_pos;
+  char found[16];
+  switch (reader_at(r, 0)) {
+    case '\0': strcpy(found, "end of input"); break;
+    case '\n': strcpy(found, "newline"); break;
+    case '\t': strcpy(found, "tab"); break;
+    case '\r': strcpy(found, "carriage return"); break;
+    case '\f': strcpy(found, "formfeed"); break;
+    case '\v': strcpy(found, "vertical tab"); break;
+    case '\a': strcpy(found, "bell"); break;
+    case '\b': strcpy(found, "backspace"); break;
+    case ' ': strcpy(found, "space"); break;
+    default: sprintf(found, "'%c'", reader_at(r, 0)); break;
+  }
+
+  char closing[16];
+  if (r->err_close) {
+    sprintf(closing, "'%c'", r->err_close);
+  } else {
+    strcpy(closing, "end of input");
+  }
+
+  const char* format = "%s:%i:%i: error: expected number, symbol, '(', '{' or %s at %s\n";
+  size_t size = strlen(format) + strlen(filename) + 64;
+  char* err = malloc(size);
+  snprintf(err, size, format, filename, row, col, closing, found);
+  return err;
+}
+
+
+
+/*******************************************************************************
+ * reader_read
+ * Reads source code straight into lvals in a single pass.
+ *
+ * @desc Accepts the same language as the mpc grammar & builds the same lvals
+ * as `lval_read` does from its AST: the whole input becomes one S-Expression.
+ * Symbols are the names in the context's builtin & special form tables, so
+ * builtins added to a context are readable without a grammar change.
+ *
+ * @param ctx - Pointer to the context supplying the symbol tables.
+ * @param filename - Name of the input, for error messages.
+ * @param src - The source code. Need not be NUL-terminated.
+ * @param len - Length of the source code.
+ * @param err - Set to a description of the error on failure, in mpc's format.
+ *        Must be freed by the caller.
+ *
+ * @return - Pointer to the S-Expression read, or NULL on error.
+ */
+lval* reader_read(lispy_ctx* ctx, const char* filename, const char* src, size_t len, char** err) {
+
+  reader r;
+  r.ctx = ctx;
+  r.src = src;
+  r.pos = src;
+  r.end = src + len;
+
+  lval* x = reader_list(&r, LVAL_SEXPR, '\0');
+  *err = x ? NULL : reader_error(&r, filename);
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_new
+ * Reads a source buffer into a document that can be edited & read again.
+ *
+ * @param ctx - Pointer to the context supplying the symbol tables.
+ * @param filename - Name of the input, for error messages.
+ * @param src - The source code, copied. Need not be NUL-terminated.
+ * @param len - Length of the source code.
+ * @param err - Set to a description of the error on failure, or NULL. Must be
+ *        freed by the caller.
+ *
+ * @return - Pointer to the document. Returned even on error, holding the forms
+ *         read before it.
+ */
+reader_doc* reader_doc_new(lispy_ctx* ctx, const char* filename, const char* src, size_t len, char** err) {
+
+  reader_doc* d = malloc(sizeof(reader_doc));
+  d->ctx = ctx;
+  d->filename = malloc(strlen(filename) + 1);
+  strcpy(d->filename, filename);
+  d->src = NULL;
+  d->len = 0;
+  d->size = 0;
+  d->forms = NULL;
+  d->count = 0;
+  d->slots = 0;
+  d->complete = 1;
+
+  reader_doc_edit(d, 0, 0, src, len, err);
+  return d;
+}
+
+
+
+/*******************************************************************************
+ * reader_lookahead
+ * Returns how far past the end of a form reading it may look: the longest
+ * symbol name, compared from a symbol's start, or a number's `.` & digit.
+ */
+static size_t reader_lookahead(lispy_ctx* ctx) {
+  char** tables[] = { operator_names, ctx->builtin_names, ctx->special_names };
+  size_t ahead = 2;
+  for (int t = 0; t < 3; t++) {
+    for (int i = 0; tables[t][i] != NULL; i++) {
+      size_t n = strlen(tables[t][i]);
+      ahead = n > ahead ? n : ahead;
+    }
+  }
+  return ahead;
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_first
+ * Returns the index of the first form whose read may have depended on the
+ * character at `offset`, or the number of forms if none did.
+ */
+static int reader_doc_first(reader_doc* d, size_t offset, size_t ahead) {
+  int lo = 0;
+  int hi = d->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (d->forms[mid].end + ahead > offset) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_at
+ * Returns the index of the form, at or after `from`, starting at `offset`, or
+ * the number of forms if none does.
+ */
+static int reader_doc_at(reader_doc* d, int from, size_t offset) {
+  int lo = from;
+  int hi = d->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (d->forms[mid].start >= offset) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo < d->count && d->forms[lo].start == offset ? lo : d->count;
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_edit
+ * Replaces part of a document's source & reads again only what it affects.
+ *
+ * @desc Reading restarts after the last form that did not look at the edited
+ * characters, & stops as soon as the reader, between forms, arrives at the
+ * start of an old form past the edit. Forms within lookahead of the edit are
+ * read again too, so `1.` & `5` still become `1.5`. Old forms past that point
+ * are kept as they are & only have their offsets moved. Afterwards `first` &
+ * `read` give the range of forms that are new.
+ *
+ * @param d - Pointer to the document.
+ * @param offset - Offset of the edit in the current source.
+ * @param removed - Number of characters removed at `offset`.
+ * @param text - Text inserted at `offset`. Need not be NUL-terminated.
+ * @param len - Length of the inserted text.
+ * @param err - Set to a description of the error on failure, or NULL. Must be
+ *        freed by the caller.
+ *
+ * @return - 1 if the whole source now reads, 0 on error. The edit is applied
+ *         either way.
+ */
+int reader_doc_edit(reader_doc* d, size_t offset, size_t removed, const char* text, size_t len, char** err) {
+
+  if (offset > d->len) { offset = d->len; }
+  if (removed > d->len - offset) { removed = d->len - offset; }
+
+  size_t ahead = reader_lookahead(d->ctx);
+  int first = reader_doc_first(d, offset, ahead);
+  size_t from = first ? d->forms[first - 1].end : 0;
+
+  // Splice the text in
+  size_t size = d->len - removed + len;
+  if (size > d->size) {
+    d->size = size > d->size * 2 ? size : d->size * 2;
+    d->src = realloc(d->src, d->size);
+  }
+  if (size) {
+    memmove(d->src + offset + len, d->src + offset + removed, d->len - offset - removed);
+    memcpy(d->src + offset, text, len);
+  }
+  d->len = size;
+
+  reader r;
+  r.ctx = d->ctx;
+  r.src = d->src;
+  r.pos = d->src + from;
+  r.end = d->src + d->len;
+
+  reader_form* read = NULL;
+  int count = 0;
+  int slots = 0;
+  int last = d->count;
+  int ok = 1;
+
+  while (1) {
+    reader_space(&r);
+
+    // Past the edit, an old form starting here reads as it did before
+    size_t at = r.pos - r.src;
+    if (at >= offset + len && (last = reader_doc_at(d, first, at - len + removed)) < d->count) {
+      break;
+    }
+    if (reader_at(&r, 0) == '\0') { break; }
+
+    lval* x = reader_expr(&r, '\0');
+    if (!x) {
+      ok = 0;
+      break;
+    }
+
+    if (count == slots) {
+      slots = slots ? slots * 2 : 4;
+      read = realloc(read, sizeof(reader_form) * slots);
+    }
+    read[count].x = x;
+    read[count].start = at;
+    read[count].end = r.pos - r.src;
+    count++;
+  }
+
+  // Forms kept from a source that did not read still end in the same error
+  if (ok && last < d->count && !d->complete) {
+    r.err_pos = d->src + d->err_pos + len - removed;
+    r.err_close = d->err_close;
+    ok = 0;
+  }
+
+  // Replace the forms in [first, last) with those read
+  for (int i = first; i < last; i++) { lval_del(d->forms[i].x); }
+
+  int total = first + count + d->count - last;
+  if (total > d->slots) {
+    d->slots = total > d->slots * 2 ? total : d->slots * 2;
+    d->forms = realloc(d->forms, sizeof(reader_form) * d->slots);
+  }
+  if (total) {
+    memmove(d->forms + first + count, d->forms + last, sizeof(reader_form) * (d->count - last));
+    if (count) { memcpy(d->forms + first, read, sizeof(reader_form) * count); }
+  }
+  free(read);
+  d->count = total;
+
+  for (int i = first + count; i < total; i++) {
+    d->forms[i].start = d->forms[i].start + len - removed;
+    d->forms[i].end = d->forms[i].end + len - removed;
+  }
+
+  d->first = first;
+  d->read = count;
+  d->complete = ok;
+  if (!ok) {
+    d->err_pos = r.err_pos - r.src;
+    d->err_close = r.err_close;
+  }
+  *err = ok ? NULL : reader_error(&r, d->filename);
+  return ok;
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_code
+ * Returns a copy of a document's forms as one S-Expression, as `reader_read`
+ * reads the source.
+ */
+lval* reader_doc_code(reader_doc* d) {
+  lval** cells = malloc(sizeof(lval*) * (d->count ? d->count : 1));
+  for (int i = 0; i < d->count; i++) { cells[i] = lval_copy(d->forms[i].x); }
+  return lval_expr(LVAL_SEXPR, cells, d->count);
+}
+
+
+
+/*******************************************************************************
+ * reader_doc_del
+ * Deletes a document along with its forms.
+ */
+void reader_doc_del(reader_doc* d) {
+  for (int i = 0; i < d->count; i++) { lval_del(d->forms[i].x); }
+  free(d->forms);
+  free(d->src);
+  free(d->filename);
+  free(d);
+}
@@ -0,0 +1,49 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include "types.h"
+
+/**
+ * reader_form
+ * A top-level form of a document & the offsets it was read from.
+ */
+typedef struct reader_form {
+  lval* x;
+  size_t start;
+  size_t end;
+} reader_form;
+
+/**
+ * reader_doc
+ * A source buffer read into top-level forms, which edits read again only in
+ * part. See `reader_doc_edit`.
+ *
+ * The forms belong to the document; copy one before evaluating it. After each
+ * edit, `read` forms starting at `first` are new & the others unchanged. If the
+ * source does not read, `complete` is 0, the forms are those before the error
+ * & `err_pos` & `err_close` say where it is.
+ */
+typedef struct reader_doc {
+  lispy_ctx* ctx;
+  char* filename;
+  char* src;
+  size_t len;
+  size_t size;
+  reader_form* forms;
+  int count;
+  int slots;
+  int first;
+  int read;
+  int complete;
+  size_t err_pos;
+  char err_close;
+} reader_doc;
+
+lval* reader_read(lispy_ctx* ctx, const char* filename, const char* src, size_t len, char** err);
+reader_doc* reader_doc_new(lispy_ctx* ctx, const char* filename, const char* src, size_t len, char** err);
+int reader_doc_edit(reader_doc* d, size_t offset, size_t removed, const char* text, size_t len, char** err);
+lval* reader_doc_code(reader_doc* d);
+void reader_doc_del(reader_doc* d);
+
+#endif
@@ -10,7 +10,9 @@ enum lval_types {
   LVAL_ERR,
   LVAL_SYM,
   LVAL_SEXPR,
-  LVAL_QEXPR
+  LVAL_QEXPR,
+  LVAL_BIG,
+  LVAL_FUTURE
 };
 
 /**
@@ -23,7 +25,11 @@ enum lval_errors {
   L_ERR_BAD_NUM,
   L_ERR_BAD_TYPE,
   L_ERR_EMPTY_Q,
-  L_ERR_ARG_COUNT
+  L_ERR_ARG_COUNT,
+  L_ERR_TIMEOUT,
+  L_ERR_CANCELLED,
+  L_ERR_TOO_LARGE,
+  L_ERR_COUNT
 };
 
 /**
@@ -35,8 +41,17 @@ typedef union {
   int err;
   char* sym;
   struct lval** cell;
+  struct bignum* big;
+  struct future* fut;
 } value;
 
+/**
+ * lispy_ctx
+ * An interpreter context, see context.h. Everything that evaluates is passed
+ * the context it evaluates in.
+ */
+typedef struct lispy_ctx lispy_ctx;
+
 /**
  * lval
  */
@@ -46,4 +61,10 @@ typedef struct lval {
   int count;
 } lval;
 
+/**
+ * lbuiltin
+ * A builtin function, called with its evaluated arguments.
+ */
+typedef lval* (*lbuiltin)(lispy_ctx*, lval*);
+
 #endif
@@ -1,33 +1,21 @@
 #include "utils.h"
-
-/*******************************************************************************
- * is_delimiter
- * Returns 1 if given string is a delimiter.
- *
- * @param content - Pointer to string to be cheked.
- *
- * @return 1 if given string matches a delimiter
- */
-int is_delimiter(char* content) {
-  return !strcmp(content, "(") || !strcmp(content, ")") || !strcmp(content, "{") || !strcmp(content, "}");
-}
-
+#include "context.h"
 
 /*******************************************************************************
  * get_lval_tag
- * Returns a node's tag's corresponding lval type.
+ * Returns the lval type of a node from the bits of the rules it matched.
  *
  * @desc Encapsulating this functionality allows us to write a switch statement
- * in lval_read() which makes it simpler to read & understand.
+ * in lval_read() which makes it simpler to read & understand. The root matches
+ * none of the grammar's rules & is read as an S-Expression.
  *
- * @param t - The tag.
- * @return tag - The corresponding lval type for tag.
+ * @param ctx - Pointer to the context whose grammar built the node.
+ * @param rules - The node's `rules`.
+ * @return tag - The corresponding lval type.
  */
-int get_lval_tag(char* t) {
-  int tag;
-  if (strstr(t, "number")) { tag = LVAL_NUM; }
-  if (strstr(t, "symbol")) { tag = LVAL_SYM; }
-  if (strstr(t, "qexpr")) { tag = LVAL_QEXPR; }
-  if (strcmp(t, ">") == 0 || strstr(t, "sexpr")) { tag = LVAL_SEXPR; }
-  return tag;
+int get_lval_tag(lispy_ctx* ctx, unsigned long rules) {
+  if (rules & ctx->number_rule) { return LVAL_NUM; }
+  if (rules & ctx->symbol_rule) { return LVAL_SYM; }
+  if (rules & ctx->qexpr_rule) { return LVAL_QEXPR; }
+  return LVAL_SEXPR;
 }
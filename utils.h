@@ -4,7 +4,6 @@
 #include <string.h>
 #include "types.h"
 
-int is_delimiter(char* content);
-int get_lval_tag(char* t);
+int get_lval_tag(lispy_ctx* ctx, unsigned long rules);
 
 #endif